@@ -15,6 +15,7 @@
 #endif
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <windows.h>
 #include <winnt.h>
 #include <intrin.h>
@@ -96,6 +97,20 @@ static int64_t __inline hdr_atomic_add_fetch_64(volatile int64_t* field, int64_t
 #endif
 }
 
+static bool __inline hdr_atomic_compare_exchange_64(volatile int64_t* field, int64_t expected, int64_t desired)
+{
+    return _InterlockedCompareExchange64(field, desired, expected) == expected;
+}
+
+static int64_t __inline hdr_atomic_or_fetch_64(volatile int64_t* field, int64_t value)
+{
+#ifdef _M_IX86
+	return InterlockedOr64(field, value) | value;
+#else
+	return _InterlockedOr64(field, value) | value;
+#endif
+}
+
 #elif defined(__ATOMIC_SEQ_CST)
 
 #define hdr_atomic_load_pointer(x) __atomic_load_n(x, __ATOMIC_SEQ_CST)
@@ -104,10 +119,13 @@ static int64_t __inline hdr_atomic_add_fetch_64(volatile int64_t* field, int64_t
 #define hdr_atomic_store_64(f,v) __atomic_store_n(f,v, __ATOMIC_SEQ_CST)
 #define hdr_atomic_exchange_64(f,i) __atomic_exchange_n(f,i, __ATOMIC_SEQ_CST)
 #define hdr_atomic_add_fetch_64(field, value) __atomic_add_fetch(field, value, __ATOMIC_SEQ_CST)
+#define hdr_atomic_compare_exchange_64(field, expected, desired) __sync_bool_compare_and_swap(field, expected, desired)
+#define hdr_atomic_or_fetch_64(field, value) __atomic_or_fetch(field, value, __ATOMIC_SEQ_CST)
 
 #elif defined(__x86_64__)
 
 #include <stdint.h>
+#include <stdbool.h>
 
 static inline void* hdr_atomic_load_pointer(void** pointer)
 {
@@ -145,6 +163,16 @@ static inline int64_t hdr_atomic_add_fetch_64(volatile int64_t* field, int64_t v
     return __sync_add_and_fetch(field, value);
 }
 
+static inline bool hdr_atomic_compare_exchange_64(volatile int64_t* field, int64_t expected, int64_t desired)
+{
+    return __sync_bool_compare_and_swap(field, expected, desired);
+}
+
+static inline int64_t hdr_atomic_or_fetch_64(volatile int64_t* field, int64_t value)
+{
+    return __sync_or_and_fetch(field, value);
+}
+
 #else
 
 #error "Unable to determine atomic operations for your platform"
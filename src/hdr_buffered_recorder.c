@@ -0,0 +1,246 @@
+/**
+ * hdr_buffered_recorder.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "hdr_atomic.h"
+#include "hdr_histogram.h"
+#include "hdr_interval_recorder.h"
+#include "hdr_buffered_recorder.h"
+
+#define HDR_RECORD_BUFFER_MASK (HDR_RECORD_BUFFER_CAPACITY - 1)
+
+static int init_common(struct hdr_buffered_recorder* br)
+{
+    int rc;
+
+    br->buffers = NULL;
+    br->dropped = 0;
+    br->mutex = hdr_mutex_alloc();
+    if (!br->mutex)
+    {
+        return ENOMEM;
+    }
+
+    rc = hdr_mutex_init(br->mutex);
+    if (0 != rc)
+    {
+        hdr_mutex_free(br->mutex);
+        return rc;
+    }
+
+    return 0;
+}
+
+int hdr_buffered_recorder_init(struct hdr_buffered_recorder* br, struct hdr_histogram* h)
+{
+    br->histogram = h;
+    br->interval_recorder = NULL;
+    return init_common(br);
+}
+
+int hdr_buffered_recorder_init_interval(struct hdr_buffered_recorder* br, struct hdr_interval_recorder* r)
+{
+    br->histogram = NULL;
+    br->interval_recorder = r;
+    return init_common(br);
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+    int64_t x = ((const struct hdr_buffered_entry*) a)->value;
+    int64_t y = ((const struct hdr_buffered_entry*) b)->value;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void record_batch(
+    struct hdr_buffered_recorder* br, struct hdr_histogram* h, struct hdr_buffered_entry* entries, size_t length)
+{
+    int64_t values[HDR_RECORD_BUFFER_CAPACITY];
+    int64_t counts[HDR_RECORD_BUFFER_CAPACITY];
+    size_t i, merged = 0;
+
+    /* Sorted, repeated buckets are adjacent and the counts are walked in order. */
+    qsort(entries, length, sizeof(struct hdr_buffered_entry), compare_entries);
+
+    for (i = 0; i < length; i++)
+    {
+        int64_t value = entries[i].value;
+
+        /* Exact values are kept when moments are tracked, otherwise any value in the bucket will do. */
+        if (merged > 0 && value >= 0 && values[merged - 1] >= 0 &&
+            (h->running_moments
+                ? values[merged - 1] == value
+                : hdr_values_are_equivalent(h, values[merged - 1], value)))
+        {
+            counts[merged - 1] += entries[i].count;
+            continue;
+        }
+
+        values[merged] = value;
+        counts[merged] = entries[i].count;
+        merged++;
+    }
+
+    br->dropped += hdr_record_values_batch_with_counts(h, values, counts, merged);
+}
+
+/*
+ * Must be called holding the recorder's mutex.  The batch is recorded with the
+ * non-atomic batch path, the mutex only serialises drains against each other, so
+ * nothing else may record into the target (or its active histogram) directly.
+ */
+static void drain(struct hdr_buffered_recorder* br, struct hdr_record_buffer* b)
+{
+    struct hdr_buffered_entry entries[HDR_RECORD_BUFFER_CAPACITY];
+    int64_t head = b->head;
+    int64_t tail = hdr_atomic_load_64(&b->tail);
+    size_t length = 0;
+    int64_t i;
+
+    if (head == tail)
+    {
+        return;
+    }
+
+    for (i = head; i < tail; i++)
+    {
+        entries[length++] = b->entries[i & HDR_RECORD_BUFFER_MASK];
+    }
+
+    /* The slots can be reused as soon as they are copied. */
+    hdr_atomic_store_64(&b->head, tail);
+
+    if (br->interval_recorder)
+    {
+        struct hdr_interval_recorder* r = br->interval_recorder;
+        int64_t val = hdr_phaser_writer_enter(&r->phaser);
+        struct hdr_histogram* active = hdr_atomic_load_pointer(&r->active);
+
+        record_batch(br, active, entries, length);
+
+        hdr_phaser_writer_exit(&r->phaser, val);
+    }
+    else
+    {
+        record_batch(br, br->histogram, entries, length);
+    }
+}
+
+static void drain_all(struct hdr_buffered_recorder* br)
+{
+    struct hdr_record_buffer* b;
+
+    for (b = br->buffers; NULL != b; b = b->next)
+    {
+        drain(br, b);
+    }
+}
+
+void hdr_buffered_recorder_destroy(struct hdr_buffered_recorder* br)
+{
+    hdr_buffered_recorder_flush(br);
+    hdr_mutex_destroy(br->mutex);
+    hdr_mutex_free(br->mutex);
+}
+
+void hdr_buffered_recorder_flush(struct hdr_buffered_recorder* br)
+{
+    hdr_mutex_lock(br->mutex);
+    drain_all(br);
+    hdr_mutex_unlock(br->mutex);
+}
+
+struct hdr_histogram* hdr_buffered_recorder_sample_and_recycle(
+    struct hdr_buffered_recorder* br, struct hdr_histogram* inactive_histogram)
+{
+    struct hdr_histogram* sample;
+
+    if (NULL == br->interval_recorder)
+    {
+        return NULL;
+    }
+
+    hdr_mutex_lock(br->mutex);
+    drain_all(br);
+    sample = hdr_interval_recorder_sample_and_recycle(br->interval_recorder, inactive_histogram);
+    hdr_mutex_unlock(br->mutex);
+
+    return sample;
+}
+
+int64_t hdr_buffered_recorder_dropped(struct hdr_buffered_recorder* br)
+{
+    int64_t dropped;
+
+    hdr_mutex_lock(br->mutex);
+    dropped = br->dropped;
+    hdr_mutex_unlock(br->mutex);
+
+    return dropped;
+}
+
+void hdr_record_buffer_init(struct hdr_record_buffer* b, struct hdr_buffered_recorder* br)
+{
+    b->recorder = br;
+    b->head = 0;
+    b->tail = 0;
+
+    hdr_mutex_lock(br->mutex);
+    b->next = br->buffers;
+    br->buffers = b;
+    hdr_mutex_unlock(br->mutex);
+}
+
+void hdr_record_buffer_destroy(struct hdr_record_buffer* b)
+{
+    struct hdr_buffered_recorder* br = b->recorder;
+    struct hdr_record_buffer** link;
+
+    hdr_mutex_lock(br->mutex);
+    drain(br, b);
+    for (link = &br->buffers; NULL != *link; link = &(*link)->next)
+    {
+        if (*link == b)
+        {
+            *link = b->next;
+            break;
+        }
+    }
+    hdr_mutex_unlock(br->mutex);
+}
+
+void hdr_record_buffer_flush(struct hdr_record_buffer* b)
+{
+    hdr_mutex_lock(b->recorder->mutex);
+    drain(b->recorder, b);
+    hdr_mutex_unlock(b->recorder->mutex);
+}
+
+void hdr_record_buffer_record_value(struct hdr_record_buffer* b, int64_t value)
+{
+    hdr_record_buffer_record_values(b, value, 1);
+}
+
+void hdr_record_buffer_record_values(struct hdr_record_buffer* b, int64_t value, int64_t count)
+{
+    int64_t tail = b->tail;
+    struct hdr_buffered_entry* entry;
+
+    if (tail - hdr_atomic_load_64(&b->head) >= HDR_RECORD_BUFFER_CAPACITY)
+    {
+        hdr_record_buffer_flush(b);
+    }
+
+    entry = &b->entries[tail & HDR_RECORD_BUFFER_MASK];
+    entry->value = value;
+    entry->count = count;
+
+    hdr_atomic_store_64(&b->tail, tail + 1);
+}
@@ -0,0 +1,169 @@
+/**
+ * hdr_buffered_recorder.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A recording front end for histograms shared between many threads.  Each
+ * thread records into its own struct hdr_record_buffer, a small ring of
+ * (value, count) pairs that only that thread writes to.  The pairs are moved
+ * into the target histogram or interval recorder in batches: when a buffer
+ * fills up, on an explicit flush and when the interval recorder is sampled.
+ * Each batch is sorted by counts index and repeated buckets are merged before
+ * the counts are touched, and the total count, min and max are updated once
+ * per batch.
+ */
+
+#ifndef HDR_BUFFERED_RECORDER_H
+#define HDR_BUFFERED_RECORDER_H 1
+
+#include <stdint.h>
+
+#include "hdr_histogram.h"
+#include "hdr_interval_recorder.h"
+#include "hdr_thread.h"
+
+#define HDR_RECORD_BUFFER_CAPACITY 256
+
+typedef struct hdr_buffered_entry
+{
+    int64_t value;
+    int64_t count;
+} hdr_buffered_entry_t;
+
+typedef struct hdr_buffered_recorder
+{
+    struct hdr_histogram* histogram;
+    struct hdr_interval_recorder* interval_recorder;
+    struct hdr_record_buffer* buffers;
+    hdr_mutex_t* mutex;
+    int64_t dropped;
+} hdr_buffered_recorder_t;
+
+typedef struct hdr_record_buffer
+{
+    struct hdr_buffered_recorder* recorder;
+    struct hdr_record_buffer* next;
+    /* Written by the flushing thread, under the recorder's mutex. */
+    int64_t head;
+    /* Kept apart from head so the owning thread doesn't share its line. */
+    uint8_t padding[64 - sizeof(int64_t)];
+    /* Written only by the owning thread. */
+    int64_t tail;
+    struct hdr_buffered_entry entries[HDR_RECORD_BUFFER_CAPACITY];
+} hdr_record_buffer_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialise a buffered recorder that flushes into a histogram.  The histogram
+ * is only written to while holding the recorder's mutex, so should be read
+ * after hdr_buffered_recorder_flush and not recorded into directly.
+ *
+ * @param br The buffered recorder to initialise.
+ * @param h The histogram to flush values into.
+ * @return 0 on success, ENOMEM if the mutex could not be allocated or the
+ * error from initialising it.
+ */
+int hdr_buffered_recorder_init(struct hdr_buffered_recorder* br, struct hdr_histogram* h);
+
+/**
+ * Initialise a buffered recorder that flushes into an interval recorder.  Samples
+ * should be taken with hdr_buffered_recorder_sample_and_recycle, so that values
+ * still buffered are included in the interval they were recorded in.
+ *
+ * Flushes record into the active histogram with the non-atomic batch functions.
+ * The recorder's mutex only serialises flushes against each other, so values
+ * must not also be recorded into the interval recorder directly, not even with
+ * the _atomic functions.
+ *
+ * @param br The buffered recorder to initialise.
+ * @param r The interval recorder to flush values into.
+ * @return 0 on success, ENOMEM if the mutex could not be allocated or the
+ * error from initialising it.
+ */
+int hdr_buffered_recorder_init_interval(struct hdr_buffered_recorder* br, struct hdr_interval_recorder* r);
+
+/**
+ * Flush any values still buffered and free the recorder's mutex.  All of the
+ * record buffers must have been destroyed first.
+ *
+ * @param br The buffered recorder to destroy.
+ */
+void hdr_buffered_recorder_destroy(struct hdr_buffered_recorder* br);
+
+/**
+ * Flush the values from all of the record buffers into the target.
+ *
+ * @param br "This" pointer
+ */
+void hdr_buffered_recorder_flush(struct hdr_buffered_recorder* br);
+
+/**
+ * Flush all of the record buffers into the interval recorder, then sample it
+ * as hdr_interval_recorder_sample_and_recycle.
+ *
+ * @param br "This" pointer, initialised with hdr_buffered_recorder_init_interval.
+ * @param inactive_histogram A histogram to reuse as the next active histogram, or NULL.
+ * @return The histogram holding the values recorded since the last sample, or NULL
+ * if the recorder flushes into a plain histogram (hdr_buffered_recorder_init).
+ */
+struct hdr_histogram* hdr_buffered_recorder_sample_and_recycle(
+    struct hdr_buffered_recorder* br, struct hdr_histogram* inactive_histogram);
+
+/**
+ * The total count of values dropped while flushing because they were negative
+ * or larger than the target's highest_trackable_value.
+ *
+ * @param br "This" pointer
+ */
+int64_t hdr_buffered_recorder_dropped(struct hdr_buffered_recorder* br);
+
+/**
+ * Initialise a record buffer and register it with the recorder.  A record buffer
+ * must only be recorded into by a single thread, usually kept in thread local
+ * storage.
+ *
+ * @param b The record buffer to initialise.
+ * @param br The buffered recorder to flush into.
+ */
+void hdr_record_buffer_init(struct hdr_record_buffer* b, struct hdr_buffered_recorder* br);
+
+/**
+ * Flush the record buffer and unregister it from the recorder.
+ *
+ * @param b The record buffer to destroy.
+ */
+void hdr_record_buffer_destroy(struct hdr_record_buffer* b);
+
+/**
+ * Buffer a value, flushing the buffer first if it is full.  Values out of
+ * range for the target are dropped when flushed.
+ *
+ * @param b "This" pointer, only to be used by the owning thread.
+ * @param value Value to record.
+ */
+void hdr_record_buffer_record_value(struct hdr_record_buffer* b, int64_t value);
+
+/**
+ * Buffer count values, flushing the buffer first if it is full.
+ *
+ * @param b "This" pointer, only to be used by the owning thread.
+ * @param value Value to record.
+ * @param count Number of 'value's to record.
+ */
+void hdr_record_buffer_record_values(struct hdr_record_buffer* b, int64_t value, int64_t count);
+
+/**
+ * Flush the values in this record buffer into the target.
+ *
+ * @param b "This" pointer
+ */
+void hdr_record_buffer_flush(struct hdr_record_buffer* b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,445 @@
+/**
+ * hdr_dbl_histogram.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "hdr_histogram.h"
+#include "hdr_histogram_log.h"
+#include "hdr_dbl_histogram.h"
+
+/* The highest value that can be covered without a later shift multiplying into infinity. */
+#define HDR_DBL_HIGHEST_ALLOWED_VALUE_EVER ldexp(1.0, 1022)
+
+static int32_t find_containing_binary_order_of_magnitude(int64_t value)
+{
+    int32_t order = 0;
+
+    while (value > 0)
+    {
+        order++;
+        value >>= 1;
+    }
+
+    return order;
+}
+
+static int32_t find_capped_containing_binary_order_of_magnitude(const struct hdr_dbl_histogram* h, double value)
+{
+    if (value > (double) h->highest_to_lowest_value_ratio)
+    {
+        return (int32_t) (log((double) h->highest_to_lowest_value_ratio) / log(2));
+    }
+    if (value > pow(2.0, 50))
+    {
+        return 50;
+    }
+
+    return find_containing_binary_order_of_magnitude((int64_t) ceil(value));
+}
+
+static int64_t internal_highest_to_lowest_value_ratio(int64_t highest_to_lowest_value_ratio)
+{
+    return INT64_C(1) << (find_containing_binary_order_of_magnitude(highest_to_lowest_value_ratio) + 1);
+}
+
+static void set_trackable_value_range(struct hdr_dbl_histogram* h, double lowest_value, double highest_value)
+{
+    h->current_lowest_value = lowest_value;
+    h->current_highest_value = highest_value;
+    h->int_to_dbl_conversion_ratio = lowest_value / h->values.sub_bucket_half_count;
+    h->dbl_to_int_conversion_ratio = 1.0 / h->int_to_dbl_conversion_ratio;
+    h->values.conversion_ratio = h->int_to_dbl_conversion_ratio;
+}
+
+/* Cover smaller values, the integer values move up. */
+static bool shift_covered_range_right(struct hdr_dbl_histogram* h, int32_t shift)
+{
+    double shift_multiplier = 1.0 / (double) (INT64_C(1) << shift);
+
+    if (0 != hdr_shift_values_left(&h->values, shift))
+    {
+        return false;
+    }
+
+    set_trackable_value_range(
+        h, h->current_lowest_value * shift_multiplier, h->current_highest_value * shift_multiplier);
+
+    return true;
+}
+
+/* Cover larger values, the integer values move down. */
+static bool shift_covered_range_left(struct hdr_dbl_histogram* h, int32_t shift)
+{
+    double shift_multiplier = (double) (INT64_C(1) << shift);
+
+    if (0 != hdr_shift_values_right(&h->values, shift))
+    {
+        return false;
+    }
+
+    set_trackable_value_range(
+        h, h->current_lowest_value * shift_multiplier, h->current_highest_value * shift_multiplier);
+
+    return true;
+}
+
+static bool adjust_range_for_value(struct hdr_dbl_histogram* h, double value)
+{
+    if (0.0 == value)
+    {
+        return true;
+    }
+
+    if (value < h->current_lowest_value)
+    {
+        do
+        {
+            int32_t shift = find_capped_containing_binary_order_of_magnitude(
+                h, ceil(h->current_lowest_value / value) - 1.0);
+
+            if (!shift_covered_range_right(h, shift))
+            {
+                return false;
+            }
+        }
+        while (value < h->current_lowest_value);
+    }
+    else if (value >= h->current_highest_value)
+    {
+        if (value > HDR_DBL_HIGHEST_ALLOWED_VALUE_EVER)
+        {
+            return false;
+        }
+
+        do
+        {
+            double ulp = nextafter(value, HUGE_VAL) - value;
+            int32_t shift = find_capped_containing_binary_order_of_magnitude(
+                h, ceil((value + ulp) / h->current_highest_value) - 1.0);
+
+            if (!shift_covered_range_left(h, shift))
+            {
+                return false;
+            }
+        }
+        while (value >= h->current_highest_value);
+    }
+
+    return true;
+}
+
+int hdr_dbl_init(
+    int64_t highest_to_lowest_value_ratio,
+    int32_t significant_figures,
+    struct hdr_dbl_histogram** result)
+{
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_dbl_histogram* dbl_histogram;
+    int64_t internal_ratio;
+    int r;
+
+    if (highest_to_lowest_value_ratio < 2)
+    {
+        return EINVAL;
+    }
+
+    if (significant_figures < 1 || 5 < significant_figures ||
+        (double) highest_to_lowest_value_ratio * pow(10.0, significant_figures) >= (double) (INT64_C(1) << 61))
+    {
+        return EINVAL;
+    }
+
+    /* The integer histogram only uses the upper half of each bucket, the lowest tracked value is half a bucket. */
+    r = hdr_calculate_bucket_config(1, 2, significant_figures, &cfg);
+    if (r)
+    {
+        return r;
+    }
+
+    internal_ratio = internal_highest_to_lowest_value_ratio(highest_to_lowest_value_ratio);
+
+    r = hdr_calculate_bucket_config(1, cfg.sub_bucket_half_count * internal_ratio - 1, significant_figures, &cfg);
+    if (r)
+    {
+        return r;
+    }
+
+    dbl_histogram = calloc(1, sizeof(struct hdr_dbl_histogram) + (size_t) cfg.counts_len * sizeof(int64_t));
+    if (!dbl_histogram)
+    {
+        return ENOMEM;
+    }
+
+    dbl_histogram->values.counts = (int64_t*) (dbl_histogram + 1);
+    hdr_init_preallocated(&dbl_histogram->values, &cfg);
+
+    dbl_histogram->highest_to_lowest_value_ratio = highest_to_lowest_value_ratio;
+    set_trackable_value_range(dbl_histogram, 1.0, (double) internal_ratio);
+
+    *result = dbl_histogram;
+
+    return 0;
+}
+
+void hdr_dbl_close(struct hdr_dbl_histogram* h)
+{
+    free(h);
+}
+
+void hdr_dbl_reset(struct hdr_dbl_histogram* h)
+{
+    hdr_reset(&h->values);
+}
+
+bool hdr_dbl_record_value(struct hdr_dbl_histogram* h, double value)
+{
+    return hdr_dbl_record_values(h, value, 1);
+}
+
+bool hdr_dbl_record_values(struct hdr_dbl_histogram* h, double value, int64_t count)
+{
+    if (!(value >= 0.0))
+    {
+        return false;
+    }
+
+    if ((value < h->current_lowest_value || h->current_highest_value <= value) && !adjust_range_for_value(h, value))
+    {
+        return false;
+    }
+
+    return hdr_record_values(&h->values, (int64_t) (value * h->dbl_to_int_conversion_ratio), count);
+}
+
+bool hdr_dbl_record_corrected_value(struct hdr_dbl_histogram* h, double value, double expected_interval)
+{
+    return hdr_dbl_record_corrected_values(h, value, 1, expected_interval);
+}
+
+bool hdr_dbl_record_corrected_values(
+    struct hdr_dbl_histogram* h, double value, int64_t count, double expected_interval)
+{
+    if (!(value >= 0.0))
+    {
+        return false;
+    }
+
+    if ((value < h->current_lowest_value || h->current_highest_value <= value) && !adjust_range_for_value(h, value))
+    {
+        return false;
+    }
+
+    /* The missing values are all >= expected_interval, try to cover them as well, but not at the cost of 'value'. */
+    if (expected_interval > 0.0 && expected_interval < h->current_lowest_value)
+    {
+        adjust_range_for_value(h, expected_interval);
+    }
+
+    return hdr_record_corrected_values(
+        &h->values,
+        (int64_t) (value * h->dbl_to_int_conversion_ratio),
+        count,
+        (int64_t) (expected_interval * h->dbl_to_int_conversion_ratio));
+}
+
+int64_t hdr_dbl_add(struct hdr_dbl_histogram* h, const struct hdr_dbl_histogram* from)
+{
+    struct hdr_iter iter;
+    int64_t dropped = 0;
+
+    hdr_iter_recorded_init(&iter, &from->values);
+
+    while (hdr_iter_next(&iter))
+    {
+        double value = (double) iter.value * from->int_to_dbl_conversion_ratio;
+        int64_t count = iter.count;
+
+        if (!hdr_dbl_record_values(h, value, count))
+        {
+            dropped += count;
+        }
+    }
+
+    return dropped;
+}
+
+double hdr_dbl_value_at_percentile(const struct hdr_dbl_histogram* h, double percentile)
+{
+    return (double) hdr_value_at_percentile(&h->values, percentile) * h->int_to_dbl_conversion_ratio;
+}
+
+double hdr_dbl_min(const struct hdr_dbl_histogram* h)
+{
+    return (double) hdr_min(&h->values) * h->int_to_dbl_conversion_ratio;
+}
+
+double hdr_dbl_max(const struct hdr_dbl_histogram* h)
+{
+    return (double) hdr_max(&h->values) * h->int_to_dbl_conversion_ratio;
+}
+
+double hdr_dbl_mean(const struct hdr_dbl_histogram* h)
+{
+    return hdr_mean(&h->values) * h->int_to_dbl_conversion_ratio;
+}
+
+double hdr_dbl_stddev(const struct hdr_dbl_histogram* h)
+{
+    return hdr_stddev(&h->values) * h->int_to_dbl_conversion_ratio;
+}
+
+int64_t hdr_dbl_count_at_value(const struct hdr_dbl_histogram* h, double value)
+{
+    if (!(value >= 0.0) || value >= h->current_highest_value)
+    {
+        return 0;
+    }
+
+    return hdr_count_at_value(&h->values, (int64_t) (value * h->dbl_to_int_conversion_ratio));
+}
+
+/*
+ * Builds a double histogram from a decoded integer histogram.  The encoding does not
+ * carry the configured ratio, so the largest ratio with the same internal layout is used.
+ */
+static int dbl_histogram_from_values(struct hdr_histogram* values, struct hdr_dbl_histogram** result)
+{
+    struct hdr_dbl_histogram* h = NULL;
+    int64_t internal_ratio;
+    int r;
+
+    if (1 != values->lowest_trackable_value || values->conversion_ratio <= 0.0)
+    {
+        return EINVAL;
+    }
+
+    internal_ratio = (values->highest_trackable_value + 1) / values->sub_bucket_half_count;
+    if (internal_ratio < 8 || 0 != (internal_ratio & (internal_ratio - 1)) ||
+        (values->highest_trackable_value + 1) != internal_ratio * values->sub_bucket_half_count)
+    {
+        return EINVAL;
+    }
+
+    r = hdr_dbl_init((internal_ratio >> 1) - 1, values->significant_figures, &h);
+    if (r)
+    {
+        return r;
+    }
+
+    set_trackable_value_range(
+        h,
+        values->conversion_ratio * values->sub_bucket_half_count,
+        values->conversion_ratio * values->sub_bucket_half_count * (double) internal_ratio);
+
+    if (0 != hdr_add(&h->values, values))
+    {
+        hdr_dbl_close(h);
+        return EINVAL;
+    }
+
+    *result = h;
+
+    return 0;
+}
+
+static int merge_values(struct hdr_histogram* values, struct hdr_dbl_histogram** histogram)
+{
+    struct hdr_dbl_histogram* decoded = NULL;
+    int r = dbl_histogram_from_values(values, &decoded);
+
+    if (r)
+    {
+        return r;
+    }
+
+    if (NULL == *histogram)
+    {
+        *histogram = decoded;
+        return 0;
+    }
+
+    r = 0 == hdr_dbl_add(*histogram, decoded) ? 0 : EINVAL;
+    hdr_dbl_close(decoded);
+
+    return r;
+}
+
+int hdr_dbl_log_encode(struct hdr_dbl_histogram* histogram, char** encoded_histogram)
+{
+    return hdr_log_encode(&histogram->values, encoded_histogram);
+}
+
+int hdr_dbl_log_decode(struct hdr_dbl_histogram** histogram, char* base64_histogram, size_t base64_len)
+{
+    struct hdr_histogram* values = NULL;
+    int r = hdr_log_decode(&values, base64_histogram, base64_len);
+
+    if (r)
+    {
+        return r;
+    }
+
+    r = merge_values(values, histogram);
+    hdr_close(values);
+
+    return r;
+}
+
+int hdr_dbl_log_write(
+    hdr_log_writer_t* writer,
+    FILE* file,
+    const hdr_timespec_t* start_timestamp,
+    const hdr_timespec_t* end_timestamp,
+    struct hdr_dbl_histogram* histogram)
+{
+    char* encoded_histogram = NULL;
+    int rc;
+
+    (void)writer;
+
+    rc = hdr_dbl_log_encode(histogram, &encoded_histogram);
+    if (rc != 0)
+    {
+        return rc;
+    }
+
+    if (fprintf(
+        file, "%.3f,%.3f,%.3f,%s\n",
+        hdr_timespec_as_double(start_timestamp),
+        hdr_timespec_as_double(end_timestamp),
+        hdr_dbl_max(histogram),
+        encoded_histogram) < 0)
+    {
+        rc = EIO;
+    }
+
+    free(encoded_histogram);
+
+    return rc;
+}
+
+int hdr_dbl_log_read(
+    hdr_log_reader_t* reader, FILE* file, struct hdr_dbl_histogram** histogram,
+    hdr_timespec_t* timestamp, hdr_timespec_t* interval)
+{
+    struct hdr_histogram* values = NULL;
+    int r = hdr_log_read(reader, file, &values, timestamp, interval);
+
+    if (r)
+    {
+        return r;
+    }
+
+    r = merge_values(values, histogram);
+    hdr_close(values);
+
+    return r;
+}
@@ -0,0 +1,236 @@
+/**
+ * hdr_dbl_histogram.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A histogram of double values.  The values are recorded into an integer
+ * hdr_histogram scaled by a conversion ratio, which is adjusted automatically
+ * (in powers of two) to keep the recorded values within the dynamic range the
+ * histogram was created with.  Recording remains constant time except for the
+ * occasional range adjustment.
+ */
+
+#ifndef HDR_DBL_HISTOGRAM_H
+#define HDR_DBL_HISTOGRAM_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "hdr_histogram.h"
+#include "hdr_histogram_log.h"
+
+typedef struct hdr_dbl_histogram
+{
+    double current_lowest_value;
+    double current_highest_value;
+    int64_t highest_to_lowest_value_ratio;
+    double int_to_dbl_conversion_ratio;
+    double dbl_to_int_conversion_ratio;
+
+    struct hdr_histogram values;
+} hdr_dbl_histogram_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allocate the memory and initialise the double histogram.
+ *
+ * @param highest_to_lowest_value_ratio The ratio between the largest and smallest
+ * (non-zero) values that can be held at the same time.  Must be at least 2.
+ * @param significant_figures The level of precision for this histogram.
+ * @param result Output parameter to capture allocated histogram.
+ * @return 0 on success, EINVAL if the ratio is < 2, the significant_figures are
+ * outside of the allowed range or the combination of the two is too large to be
+ * represented, ENOMEM if the allocation failed.
+ */
+int hdr_dbl_init(
+    int64_t highest_to_lowest_value_ratio,
+    int32_t significant_figures,
+    struct hdr_dbl_histogram** result);
+
+/**
+ * Free the memory and close the double histogram.
+ *
+ * @param h The histogram you want to close.
+ */
+void hdr_dbl_close(struct hdr_dbl_histogram* h);
+
+/**
+ * Reset the histogram to zero.  The current value range is kept.
+ *
+ * @param h "This" pointer
+ */
+void hdr_dbl_reset(struct hdr_dbl_histogram* h);
+
+/**
+ * Records a value in the histogram, shifting the covered range if the value is
+ * outside of it.
+ *
+ * @param h "This" pointer
+ * @param value Value to add to the histogram
+ * @return false if the value is negative (or NaN), or cannot be covered without
+ * losing already recorded values, true otherwise.
+ */
+bool hdr_dbl_record_value(struct hdr_dbl_histogram* h, double value);
+
+/**
+ * Records count values in the histogram, shifting the covered range if the value
+ * is outside of it.
+ *
+ * @param h "This" pointer
+ * @param value Value to add to the histogram
+ * @param count Number of 'value's to add to the histogram
+ * @return false if the value is negative (or NaN), or cannot be covered without
+ * losing already recorded values, true otherwise.
+ */
+bool hdr_dbl_record_values(struct hdr_dbl_histogram* h, double value, int64_t count);
+
+/**
+ * Record a value in the histogram and backfill based on an expected interval, see
+ * hdr_record_corrected_value.
+ *
+ * @param h "This" pointer
+ * @param value Value to add to the histogram
+ * @param expected_interval The delay between recording values.
+ * @return false if the value could not be recorded, true otherwise.
+ */
+bool hdr_dbl_record_corrected_value(struct hdr_dbl_histogram* h, double value, double expected_interval);
+
+/**
+ * Record count values in the histogram and backfill based on an expected interval,
+ * see hdr_record_corrected_values.
+ *
+ * @param h "This" pointer
+ * @param value Value to add to the histogram
+ * @param count Number of 'value's to add to the histogram
+ * @param expected_interval The delay between recording values.
+ * @return false if the value could not be recorded, true otherwise.
+ */
+bool hdr_dbl_record_corrected_values(
+    struct hdr_dbl_histogram* h, double value, int64_t count, double expected_interval);
+
+/**
+ * Adds all of the values from 'from' to 'h'.  The histograms do not need to cover
+ * the same range.
+ *
+ * @param h "This" pointer
+ * @param from Histogram to copy values from.
+ * @return The number of values dropped when copying.
+ */
+int64_t hdr_dbl_add(struct hdr_dbl_histogram* h, const struct hdr_dbl_histogram* from);
+
+/**
+ * Get the value at a specific percentile.
+ *
+ * @param h "This" pointer.
+ * @param percentile The percentile to get the value for
+ */
+double hdr_dbl_value_at_percentile(const struct hdr_dbl_histogram* h, double percentile);
+
+/**
+ * Get minimum value from the histogram.  Will return 0.0 if the histogram is empty.
+ *
+ * @param h "This" pointer
+ */
+double hdr_dbl_min(const struct hdr_dbl_histogram* h);
+
+/**
+ * Get maximum value from the histogram.  Will return 0.0 if the histogram is empty.
+ *
+ * @param h "This" pointer
+ */
+double hdr_dbl_max(const struct hdr_dbl_histogram* h);
+
+/**
+ * Gets the mean for the values in the histogram.
+ *
+ * @param h "This" pointer
+ * @return The mean
+ */
+double hdr_dbl_mean(const struct hdr_dbl_histogram* h);
+
+/**
+ * Gets the standard deviation for the values in the histogram.
+ *
+ * @param h "This" pointer
+ * @return The standard deviation
+ */
+double hdr_dbl_stddev(const struct hdr_dbl_histogram* h);
+
+/**
+ * Get the count of recorded values at a specific value (to within the
+ * histogram resolution at the value level).
+ *
+ * @param h "This" pointer
+ * @param value The value for which to retrieve the count
+ * @return The total count of values recorded in the histogram within the value
+ * range that is >= lowest_equivalent_value(value) and <= highest_equivalent_value(value)
+ */
+int64_t hdr_dbl_count_at_value(const struct hdr_dbl_histogram* h, double value);
+
+/**
+ * Encode and compress the histogram with base64 encoding.  The integer values are
+ * written in the standard encoding, with the current conversion ratio.
+ *
+ * @param histogram that is to be encoded
+ * @param encoded_histogram the output buffer where the histogram is written to
+ * @return 0 on success, ENOMEM if the buffers could not be allocated or an
+ * encoding error (see hdr_strerror).
+ */
+int hdr_dbl_log_encode(struct hdr_dbl_histogram* histogram, char** encoded_histogram);
+
+/**
+ * Decode and decompress a histogram encoded with hdr_dbl_log_encode.  The range of
+ * the decoded histogram is taken from the encoded integer histogram.  If
+ * *histogram is not NULL the decoded values are added to it.
+ *
+ * @param histogram the histogram to decode into, or a pointer to NULL to allocate one
+ * @param base64_histogram the base64 encoded histogram
+ * @param base64_len the length of the base64 string
+ * @return 0 on success, EINVAL if the encoding is not for a double histogram or
+ * a decoding error (see hdr_strerror).
+ */
+int hdr_dbl_log_decode(struct hdr_dbl_histogram** histogram, char* base64_histogram, size_t base64_len);
+
+/**
+ * Write a double histogram to the log as a single entry, in the same format as
+ * hdr_log_write.
+ *
+ * @param writer 'This' pointer
+ * @param file The stream to write to
+ * @param start_timestamp The start timestamp of the interval
+ * @param end_timestamp The end timestamp of the interval
+ * @param histogram The histogram to encode and write.
+ * @return 0 on success, EIO if the write failed or an encoding error.
+ */
+int hdr_dbl_log_write(
+    hdr_log_writer_t* writer,
+    FILE* file,
+    const hdr_timespec_t* start_timestamp,
+    const hdr_timespec_t* end_timestamp,
+    struct hdr_dbl_histogram* histogram);
+
+/**
+ * Reads an entry written by hdr_dbl_log_write.  If *histogram is NULL a new
+ * histogram is allocated, otherwise the values are added to it.
+ *
+ * @param reader 'This' pointer
+ * @param file The stream to read from
+ * @param histogram Pointer to allocate a histogram to or to merge into.
+ * @param timestamp The first timestamp from the CSV entry.
+ * @param interval The second timestamp from the CSV entry
+ * @return 0 on success, EOF at the end of the log, EINVAL if the entry is not a
+ * double histogram or another error as for hdr_log_read.
+ */
+int hdr_dbl_log_read(
+    hdr_log_reader_t* reader, FILE* file, struct hdr_dbl_histogram** histogram,
+    hdr_timespec_t* timestamp, hdr_timespec_t* interval);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
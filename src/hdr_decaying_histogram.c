@@ -0,0 +1,201 @@
+/**
+ * hdr_decaying_histogram.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+
+#include "hdr_histogram.h"
+#include "hdr_decaying_histogram.h"
+#include "hdr_internal.h"
+
+/*
+ * Counts are stored in fixed point, a value recorded at the landmark adds
+ * HDR_DECAY_UNIT.  The landmark moves once weights reach exp(HDR_DECAY_MAX_EXPONENT),
+ * keeping a single record well below 2^32 so the counts can't overflow.
+ */
+#define HDR_DECAY_UNIT 64.0
+#define HDR_DECAY_MAX_EXPONENT 12.0
+
+int hdr_decaying_init(
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    double half_life,
+    int64_t now,
+    struct hdr_decaying_histogram** result)
+{
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_decaying_histogram* h;
+    int r;
+
+    if (!(half_life > 0.0))
+    {
+        return EINVAL;
+    }
+
+    r = hdr_calculate_bucket_config(lowest_trackable_value, highest_trackable_value, significant_figures, &cfg);
+    if (r)
+    {
+        return r;
+    }
+
+    h = calloc(1, sizeof(struct hdr_decaying_histogram) + (size_t) cfg.counts_len * sizeof(int64_t));
+    if (!h)
+    {
+        return ENOMEM;
+    }
+
+    h->values.counts = (int64_t*) (h + 1);
+    hdr_init_preallocated(&h->values, &cfg);
+
+    h->decay_rate = log(2.0) / half_life;
+    h->landmark = now;
+
+    *result = h;
+
+    return 0;
+}
+
+void hdr_decaying_close(struct hdr_decaying_histogram* h)
+{
+    free(h);
+}
+
+void hdr_decaying_reset(struct hdr_decaying_histogram* h, int64_t now)
+{
+    hdr_reset(&h->values);
+    h->landmark = now;
+}
+
+/* Times before the landmark are treated as the landmark. */
+static double elapsed(const struct hdr_decaying_histogram* h, int64_t now)
+{
+    return now > h->landmark ? (double) (now - h->landmark) : 0.0;
+}
+
+static int64_t scale_count(int64_t count, double factor)
+{
+    return (int64_t) ((double) count * factor + 0.5);
+}
+
+void hdr_decaying_rescale(struct hdr_decaying_histogram* h, int64_t now)
+{
+    struct hdr_histogram* values = &h->values;
+    int64_t* counts = values->counts;
+    double factor;
+    int64_t total = 0;
+    int32_t lowest, highest, i;
+
+    if (now <= h->landmark)
+    {
+        return;
+    }
+
+    factor = exp(-h->decay_rate * elapsed(h, now));
+
+    hdr_counts_touched_range(values, &lowest, &highest);
+    lowest = lowest > 1 ? lowest : 1;
+
+    /*
+     * Scaling doesn't depend on where a count sits, so unshifted counts only need the
+     * touched range and the zero index, and this loop vectorises.  If the values have
+     * been shifted the touched range may wrap around the counts, so all of them are
+     * scaled instead.
+     */
+    if (0 == values->normalizing_index_offset)
+    {
+        counts[0] = scale_count(counts[0], factor);
+        total = counts[0];
+
+        for (i = lowest; i <= highest; i++)
+        {
+            counts[i] = scale_count(counts[i], factor);
+            total += counts[i];
+        }
+    }
+    else
+    {
+        for (i = 0; i < values->counts_len; i++)
+        {
+            counts[i] = scale_count(counts[i], factor);
+            total += counts[i];
+        }
+    }
+
+    while (lowest <= highest && 0 == hdr_count_at_index(values, lowest))
+    {
+        lowest++;
+    }
+    while (highest >= lowest && 0 == hdr_count_at_index(values, highest))
+    {
+        highest--;
+    }
+
+    values->total_count = total;
+    if (lowest <= highest)
+    {
+        values->min_value = hdr_value_at_index(values, lowest);
+        values->max_value = hdr_next_non_equivalent_value(values, hdr_value_at_index(values, highest)) - 1;
+    }
+    else
+    {
+        values->min_value = INT64_MAX;
+        values->max_value = 0;
+    }
+
+    if (values->running_moments)
+    {
+        values->moments_sum *= factor;
+        values->moments_sum_of_squares *= factor;
+    }
+
+    h->landmark = now;
+}
+
+bool hdr_decaying_record_value(struct hdr_decaying_histogram* h, int64_t value, int64_t now)
+{
+    return hdr_decaying_record_values(h, value, 1, now);
+}
+
+bool hdr_decaying_record_values(struct hdr_decaying_histogram* h, int64_t value, int64_t count, int64_t now)
+{
+    double exponent = h->decay_rate * elapsed(h, now);
+    double weighted;
+    int64_t weighted_count;
+
+    if (exponent > HDR_DECAY_MAX_EXPONENT)
+    {
+        hdr_decaying_rescale(h, now);
+        exponent = 0.0;
+    }
+
+    /* Counts whose weight doesn't fit in an int64_t can't be recorded. */
+    weighted = (double) count * HDR_DECAY_UNIT * exp(exponent);
+    if (fabs(weighted) >= (double) INT64_MAX)
+    {
+        return false;
+    }
+
+    weighted_count = (int64_t) (weighted + 0.5);
+    if (0 == weighted_count)
+    {
+        return value >= 0 && value <= h->values.highest_trackable_value;
+    }
+
+    return hdr_record_values(&h->values, value, weighted_count);
+}
+
+double hdr_decaying_count(const struct hdr_decaying_histogram* h, int64_t now)
+{
+    return (double) h->values.total_count / HDR_DECAY_UNIT * exp(-h->decay_rate * elapsed(h, now));
+}
+
+int64_t hdr_decaying_value_at_percentile(const struct hdr_decaying_histogram* h, double percentile)
+{
+    return hdr_value_at_percentile(&h->values, percentile);
+}
@@ -0,0 +1,135 @@
+/**
+ * hdr_decaying_histogram.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A histogram whose values are weighted by how recently they were recorded,
+ * using forward decay: a value recorded at time t counts exp(rate * (t - L))
+ * times, relative to a landmark time L.  Since weights only grow with time,
+ * older values lose weight relative to newer ones without touching the counts,
+ * and percentiles are biased towards recent values with a single histogram
+ * instead of a ring of interval histograms.  When the weights grow too large
+ * the landmark is moved forward, scaling all of the counts down in one pass.
+ */
+
+#ifndef HDR_DECAYING_HISTOGRAM_H
+#define HDR_DECAYING_HISTOGRAM_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hdr_histogram.h"
+
+typedef struct hdr_decaying_histogram
+{
+    double decay_rate;
+    int64_t landmark;
+
+    struct hdr_histogram values;
+} hdr_decaying_histogram_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allocate the memory and initialise the decaying histogram.  Times are in any
+ * unit chosen by the caller (e.g. milliseconds), as long as they are used
+ * consistently.
+ *
+ * @param lowest_trackable_value The smallest possible value to be put into the
+ * histogram.
+ * @param highest_trackable_value The largest possible value to be put into the
+ * histogram.
+ * @param significant_figures The level of precision for this histogram.
+ * @param half_life The time for the weight of a value to halve, relative to a
+ * value recorded now.
+ * @param now The current time, used as the first landmark.
+ * @param result Output parameter to capture allocated histogram.
+ * @return 0 on success, EINVAL if any of the parameters are invalid, ENOMEM if
+ * the allocation failed.
+ */
+int hdr_decaying_init(
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    double half_life,
+    int64_t now,
+    struct hdr_decaying_histogram** result);
+
+/**
+ * Free the memory and close the decaying histogram.
+ *
+ * @param h The histogram you want to close.
+ */
+void hdr_decaying_close(struct hdr_decaying_histogram* h);
+
+/**
+ * Reset the histogram to zero, with now as the new landmark.
+ *
+ * @param h "This" pointer
+ * @param now The current time.
+ */
+void hdr_decaying_reset(struct hdr_decaying_histogram* h, int64_t now);
+
+/**
+ * Records a value recorded at time now.  Rescales the histogram first if the
+ * weight for now has grown too large.
+ *
+ * @param h "This" pointer
+ * @param value Value to add to the histogram
+ * @param now The time the value was recorded, times before the landmark are
+ * recorded as if at the landmark.
+ * @return false if the value is outside the range of the histogram, true otherwise.
+ */
+bool hdr_decaying_record_value(struct hdr_decaying_histogram* h, int64_t value, int64_t now);
+
+/**
+ * Records count values recorded at time now.
+ *
+ * @param h "This" pointer
+ * @param value Value to add to the histogram
+ * @param count Number of 'value's to add to the histogram
+ * @param now The time the values were recorded, times before the landmark are
+ * recorded as if at the landmark.
+ * @return false if the value is outside the range of the histogram or the
+ * weighted count would overflow, true otherwise.
+ */
+bool hdr_decaying_record_values(struct hdr_decaying_histogram* h, int64_t value, int64_t count, int64_t now);
+
+/**
+ * Moves the landmark to now, scaling all of the counts down by the weight of
+ * now in a single pass.  Counts that decay below one unit of weight are
+ * dropped.  Happens automatically when recording, but can also be called
+ * periodically, e.g. so that idle histograms forget old values.  Does nothing
+ * if now is not after the landmark.
+ *
+ * @param h "This" pointer
+ * @param now The current time.
+ */
+void hdr_decaying_rescale(struct hdr_decaying_histogram* h, int64_t now);
+
+/**
+ * The number of values in the histogram, weighted by their age at time now.
+ *
+ * @param h "This" pointer
+ * @param now The current time.
+ * @return The decayed count.
+ */
+double hdr_decaying_count(const struct hdr_decaying_histogram* h, int64_t now);
+
+/**
+ * Get the value at a specific percentile, weighting values by how recently
+ * they were recorded.  Any other query on h->values (mean, iterators, etc.)
+ * is weighted the same way.
+ *
+ * @param h "This" pointer.
+ * @param percentile The percentile to get the value for
+ */
+int64_t hdr_decaying_value_at_percentile(const struct hdr_decaying_histogram* h, double percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
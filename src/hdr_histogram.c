@@ -18,10 +18,15 @@
 #include <windows.h>
 #include <winnt.h>
 #include <intrin.h>
+#include <malloc.h>
+#else
+#include <sys/mman.h>
 #endif
 
 #include "hdr_histogram.h"
 #include "hdr_tests.h"
+#include "hdr_internal.h"
+#include "hdr_atomic.h"
 
 /*  ######   #######  ##     ## ##    ## ########  ######  */
 /* ##    ## ##     ## ##     ## ###   ##    ##    ##    ## */
@@ -54,8 +59,338 @@ static int32_t normalize_index(const struct hdr_histogram* h, int32_t index)
     return normalized_index + adjustment;
 }
 
+void* hdr_allocator_malloc(const struct hdr_allocator* allocator, size_t size)
+{
+    return allocator ? allocator->malloc_fn(allocator->context, size) : malloc(size);
+}
+
+void* hdr_allocator_calloc(const struct hdr_allocator* allocator, size_t count, size_t size)
+{
+    return allocator ? allocator->calloc_fn(allocator->context, count, size) : calloc(count, size);
+}
+
+void hdr_allocator_free(const struct hdr_allocator* allocator, void* ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    if (allocator)
+    {
+        allocator->free_fn(allocator->context, ptr);
+    }
+    else
+    {
+        free(ptr);
+    }
+}
+
+/* Allocators have no realloc, so outside of libc the block is always copied. */
+static void* allocator_realloc(const struct hdr_allocator* allocator, void* ptr, size_t old_size, size_t size)
+{
+    void* block;
+
+    if (!allocator)
+    {
+        return realloc(ptr, size);
+    }
+
+    block = allocator->malloc_fn(allocator->context, size);
+    if (block && ptr)
+    {
+        memcpy(block, ptr, old_size < size ? old_size : size);
+        allocator->free_fn(allocator->context, ptr);
+    }
+
+    return block;
+}
+
+/*
+ * Packed counts are split into pages of (1 << packed_page_magnitude) counters.  A page
+ * is only allocated when something is first recorded into it, and it holds its
+ * counters in the narrowest word that fits the largest of them, widening on overflow.
+ */
+#define HDR_PACKED_PAGE_MAGNITUDE 8
+
+struct hdr_packed_page
+{
+    int32_t word_size;
+    int32_t reserved;
+};
+
+static int32_t packed_page_len(const struct hdr_histogram* h)
+{
+    return 1 << h->packed_page_magnitude;
+}
+
+static int32_t packed_page_count(const struct hdr_histogram* h)
+{
+    return h->counts_len >> h->packed_page_magnitude;
+}
+
+static int32_t packed_word_size_for(int64_t value)
+{
+    if (value < 0 || value > (int64_t) UINT32_MAX)
+    {
+        return 8;
+    }
+    if (value > (int64_t) UINT16_MAX)
+    {
+        return 4;
+    }
+    if (value > (int64_t) UINT8_MAX)
+    {
+        return 2;
+    }
+    return 1;
+}
+
+static size_t packed_page_size(const struct hdr_histogram* h, int32_t word_size)
+{
+    return sizeof(struct hdr_packed_page) + (size_t) packed_page_len(h) * (size_t) word_size;
+}
+
+static int64_t packed_page_get(const struct hdr_packed_page* page, int32_t offset)
+{
+    switch (page->word_size)
+    {
+        case 1:
+            return ((const uint8_t*) (page + 1))[offset];
+        case 2:
+            return ((const uint16_t*) (page + 1))[offset];
+        case 4:
+            return ((const uint32_t*) (page + 1))[offset];
+        default:
+            return ((const int64_t*) (page + 1))[offset];
+    }
+}
+
+static void packed_page_set(struct hdr_packed_page* page, int32_t offset, int64_t value)
+{
+    switch (page->word_size)
+    {
+        case 1:
+            ((uint8_t*) (page + 1))[offset] = (uint8_t) value;
+            break;
+        case 2:
+            ((uint16_t*) (page + 1))[offset] = (uint16_t) value;
+            break;
+        case 4:
+            ((uint32_t*) (page + 1))[offset] = (uint32_t) value;
+            break;
+        default:
+            ((int64_t*) (page + 1))[offset] = value;
+            break;
+    }
+}
+
+static struct hdr_packed_page* packed_page_alloc(const struct hdr_histogram* h, int32_t word_size)
+{
+    struct hdr_packed_page* page = hdr_allocator_calloc(h->allocator, 1, packed_page_size(h, word_size));
+    if (page)
+    {
+        page->word_size = word_size;
+    }
+    return page;
+}
+
+static bool packed_page_widen(struct hdr_histogram* h, int32_t page_index, int32_t word_size)
+{
+    struct hdr_packed_page* page = h->packed_pages[page_index];
+    struct hdr_packed_page* wider = packed_page_alloc(h, word_size);
+    int32_t i;
+
+    if (!wider)
+    {
+        return false;
+    }
+
+    for (i = 0; i < packed_page_len(h); i++)
+    {
+        packed_page_set(wider, i, packed_page_get(page, i));
+    }
+
+    hdr_allocator_free(h->allocator, page);
+    h->packed_pages[page_index] = wider;
+
+    return true;
+}
+
+static int64_t packed_get(const struct hdr_histogram* h, int32_t index)
+{
+    const struct hdr_packed_page* page = h->packed_pages[index >> h->packed_page_magnitude];
+    return page ? packed_page_get(page, index & (packed_page_len(h) - 1)) : 0;
+}
+
+/*
+ * The first (logical) index from 'index' onwards that is not in an absent page.  The
+ * normalizing offset is a whole number of half buckets, so logical pages map onto
+ * physical ones.
+ */
+static int32_t next_present_index(const struct hdr_histogram* h, int32_t index)
+{
+    if (h->counts)
+    {
+        return index;
+    }
+
+    while (index < h->counts_len && !h->packed_pages[normalize_index(h, index) >> h->packed_page_magnitude])
+    {
+        index = (index | (packed_page_len(h) - 1)) + 1;
+    }
+
+    return index;
+}
+
+/*
+ * Histograms with occupancy tracking enabled keep a bitmap, one bit per counts index,
+ * in the same allocation directly after the counts.  A clear bit means the count is
+ * zero, so the iterators can find the next non-zero count a word at a time.  A set bit
+ * only means the count may be non-zero.
+ */
+static int32_t occupancy_words(int32_t counts_len)
+{
+    return (counts_len + 63) >> 6;
+}
+
+static uint64_t* occupancy_of(const struct hdr_histogram* h)
+{
+    return (uint64_t*) (h->counts + h->counts_len);
+}
+
+static void occupancy_mark(struct hdr_histogram* h, int32_t index)
+{
+    occupancy_of(h)[index >> 6] |= UINT64_C(1) << (index & 63);
+}
+
+static void occupancy_mark_atomic(struct hdr_histogram* h, int32_t index)
+{
+    int64_t* word = (int64_t*) &occupancy_of(h)[index >> 6];
+    int64_t bit = (int64_t) (UINT64_C(1) << (index & 63));
+
+    /* Skip the locked write once the bit is set, as it nearly always is. */
+    if (0 == (hdr_atomic_load_64(word) & bit))
+    {
+        hdr_atomic_or_fetch_64(word, bit);
+    }
+}
+
+static void occupancy_rebuild(struct hdr_histogram* h)
+{
+    int32_t i;
+
+    memset(occupancy_of(h), 0, (size_t) occupancy_words(h->counts_len) * sizeof(uint64_t));
+    for (i = 0; i < h->counts_len; i++)
+    {
+        if (0 != h->counts[i])
+        {
+            occupancy_mark(h, i);
+        }
+    }
+}
+
+#if defined(_MSC_VER)
+#pragma intrinsic(_BitScanForward64)
+#endif
+
+static int32_t count_trailing_zeros_64(uint64_t value)
+{
+#if defined(_MSC_VER)
+    unsigned long index = 0;
+    _BitScanForward64(&index, value);
+    return (int32_t) index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+/*
+ * The first (logical) index from 'index' onwards that may hold a non-zero count, using
+ * the occupancy bitmap or the page table, or counts_len if there is none.
+ */
+static int32_t next_occupied_index(const struct hdr_histogram* h, int32_t index)
+{
+    const uint64_t* occupancy;
+
+    if (!h->counts)
+    {
+        return next_present_index(h, index);
+    }
+
+    if (!h->track_occupancy)
+    {
+        return index;
+    }
+
+    occupancy = occupancy_of(h);
+    while (index < h->counts_len)
+    {
+        int32_t physical = normalize_index(h, index);
+        uint64_t word = occupancy[physical >> 6] >> (physical & 63);
+        int32_t to_word_end = 64 - (physical & 63);
+        int32_t to_array_end = h->counts_len - physical;
+
+        if (0 != word)
+        {
+            index += count_trailing_zeros_64(word);
+            return index < h->counts_len ? index : h->counts_len;
+        }
+
+        /* Logical indexes wrap round at the physical end of the array. */
+        index += to_word_end < to_array_end ? to_word_end : to_array_end;
+    }
+
+    return h->counts_len;
+}
+
+static bool packed_add(struct hdr_histogram* h, int32_t index, int64_t value)
+{
+    int32_t page_index = index >> h->packed_page_magnitude;
+    int32_t offset = index & (packed_page_len(h) - 1);
+    struct hdr_packed_page* page = h->packed_pages[page_index];
+    int64_t updated;
+    int32_t word_size;
+
+    if (!page)
+    {
+        if (0 == value)
+        {
+            return true;
+        }
+
+        word_size = packed_word_size_for(value);
+        page = packed_page_alloc(h, word_size > h->packed_min_word_size ? word_size : h->packed_min_word_size);
+        if (!page)
+        {
+            return false;
+        }
+        h->packed_pages[page_index] = page;
+    }
+
+    updated = packed_page_get(page, offset) + value;
+    word_size = packed_word_size_for(updated);
+
+    if (word_size > page->word_size)
+    {
+        if (!packed_page_widen(h, page_index, word_size))
+        {
+            return false;
+        }
+        page = h->packed_pages[page_index];
+    }
+
+    packed_page_set(page, offset, updated);
+
+    return true;
+}
+
 static int64_t counts_get_direct(const struct hdr_histogram* h, int32_t index)
 {
+    if (!h->counts)
+    {
+        return packed_get(h, index);
+    }
     return h->counts[index];
 }
 
@@ -64,12 +399,47 @@ static int64_t counts_get_normalised(const struct hdr_histogram* h, int32_t inde
     return counts_get_direct(h, normalize_index(h, index));
 }
 
-static void counts_inc_normalised(
+static bool counts_add_direct(struct hdr_histogram* h, int32_t index, int64_t value)
+{
+    if (!h->counts)
+    {
+        return packed_add(h, index, value);
+    }
+    h->counts[index] += value;
+    if (h->track_occupancy)
+    {
+        occupancy_mark(h, index);
+    }
+    return true;
+}
+
+static void counts_set_direct(struct hdr_histogram* h, int32_t index, int64_t value)
+{
+    counts_add_direct(h, index, value - counts_get_direct(h, index));
+}
+
+static bool counts_inc_normalised(
     struct hdr_histogram* h, int32_t index, int64_t value)
 {
     int32_t normalised_index = normalize_index(h, index);
-    h->counts[normalised_index] += value;
+    if (!counts_add_direct(h, normalised_index, value))
+    {
+        return false;
+    }
     h->total_count += value;
+    return true;
+}
+
+static void counts_inc_normalised_atomic(
+    struct hdr_histogram* h, int32_t index, int64_t value)
+{
+    int32_t normalised_index = normalize_index(h, index);
+    hdr_atomic_add_fetch_64(&h->counts[normalised_index], value);
+    if (h->track_occupancy)
+    {
+        occupancy_mark_atomic(h, normalised_index);
+    }
+    hdr_atomic_add_fetch_64(&h->total_count, value);
 }
 
 static void update_min_max(struct hdr_histogram* h, int64_t value)
@@ -78,6 +448,52 @@ static void update_min_max(struct hdr_histogram* h, int64_t value)
     h->max_value = (value > h->max_value) ? value : h->max_value;
 }
 
+static void update_min_max_atomic(struct hdr_histogram* h, int64_t value)
+{
+    int64_t current_min_value;
+    int64_t current_max_value;
+
+    do
+    {
+        current_min_value = hdr_atomic_load_64(&h->min_value);
+
+        if (0 == value || current_min_value <= value)
+        {
+            break;
+        }
+    }
+    while (!hdr_atomic_compare_exchange_64(&h->min_value, current_min_value, value));
+
+    do
+    {
+        current_max_value = hdr_atomic_load_64(&h->max_value);
+
+        if (value <= current_max_value)
+        {
+            break;
+        }
+    }
+    while (!hdr_atomic_compare_exchange_64(&h->max_value, current_max_value, value));
+}
+
+union moments_dbl_cvt
+{
+    int64_t l;
+    double d;
+};
+
+static void atomic_add_double(double* field, double value)
+{
+    union moments_dbl_cvt current, updated;
+
+    do
+    {
+        current.l = hdr_atomic_load_64((int64_t*) field);
+        updated.d = current.d + value;
+    }
+    while (!hdr_atomic_compare_exchange_64((int64_t*) field, current.l, updated.l));
+}
+
 /* ##     ## ######## #### ##       #### ######## ##    ## */
 /* ##     ##    ##     ##  ##        ##     ##     ##  ##  */
 /* ##     ##    ##     ##  ##        ##     ##      ####   */
@@ -142,6 +558,20 @@ int32_t counts_index_for(const struct hdr_histogram* h, int64_t value)
     return counts_index(h, bucket_index, sub_bucket_index);
 }
 
+/*
+ * The (logical) indexes between the min and max non-zero values, the only ones other
+ * than index 0 that can hold counts.  Derived from the min/max that recording already
+ * maintains, so it costs nothing to track.  lowest > highest if nothing non-zero was
+ * recorded.
+ */
+void hdr_counts_touched_range(const struct hdr_histogram* h, int32_t* lowest, int32_t* highest)
+{
+    int32_t max_index = counts_index_for(h, h->max_value);
+
+    *lowest = INT64_MAX == h->min_value ? h->counts_len : counts_index_for(h, h->min_value);
+    *highest = max_index < h->counts_len ? max_index : h->counts_len - 1;
+}
+
 int64_t hdr_value_at_index(const struct hdr_histogram *h, int32_t index)
 {
     int32_t bucket_index = (index >> h->sub_bucket_half_count_magnitude) - 1;
@@ -186,6 +616,37 @@ int64_t hdr_median_equivalent_value(const struct hdr_histogram *h, int64_t value
     return lowest_equivalent_value(h, value) + (hdr_size_of_equivalent_value_range(h, value) >> 1);
 }
 
+static void update_moments(struct hdr_histogram* h, int64_t value, int64_t count)
+{
+    double median = (double) hdr_median_equivalent_value(h, value);
+    h->moments_sum += median * count;
+    h->moments_sum_of_squares += median * median * count;
+}
+
+static void update_moments_atomic(struct hdr_histogram* h, int64_t value, int64_t count)
+{
+    double median = (double) hdr_median_equivalent_value(h, value);
+    atomic_add_double(&h->moments_sum, median * count);
+    atomic_add_double(&h->moments_sum_of_squares, median * median * count);
+}
+
+static void reset_moments(struct hdr_histogram* h)
+{
+    int32_t i;
+
+    h->moments_sum = 0.0;
+    h->moments_sum_of_squares = 0.0;
+
+    for (i = 0; i < h->counts_len; i++)
+    {
+        int64_t count = counts_get_normalised(h, i);
+        if (0 != count)
+        {
+            update_moments(h, hdr_value_at_index(h, i), count);
+        }
+    }
+}
+
 static int64_t non_zero_min(const struct hdr_histogram* h)
 {
     if (INT64_MAX == h->min_value)
@@ -203,11 +664,17 @@ void hdr_reset_internal_counters(struct hdr_histogram* h)
     int64_t observed_total_count = 0;
     int i;
 
-    for (i = 0; i < h->counts_len; i++)
+    /* The counts may have been written directly, e.g. when decoding. */
+    if (h->track_occupancy)
+    {
+        occupancy_rebuild(h);
+    }
+
+    for (i = next_present_index(h, 0); i < h->counts_len; i = next_present_index(h, i + 1))
     {
         int64_t count_at_index;
 
-        if ((count_at_index = counts_get_direct(h, i)) > 0)
+        if ((count_at_index = counts_get_normalised(h, i)) > 0)
         {
             observed_total_count += count_at_index;
             max_index = i;
@@ -238,6 +705,11 @@ void hdr_reset_internal_counters(struct hdr_histogram* h)
     }
 
     h->total_count = observed_total_count;
+
+    if (h->running_moments)
+    {
+        reset_moments(h);
+    }
 }
 
 static int32_t buckets_needed_to_cover_value(int64_t value, int32_t sub_bucket_count, int32_t unit_magnitude)
@@ -326,6 +798,17 @@ void hdr_init_preallocated(struct hdr_histogram* h, struct hdr_histogram_bucket_
     h->bucket_count                    = cfg->bucket_count;
     h->counts_len                      = cfg->counts_len;
     h->total_count                     = 0;
+    h->running_moments                 = false;
+    h->moments_sum                     = 0.0;
+    h->moments_sum_of_squares          = 0.0;
+    h->packed_pages                    = NULL;
+    h->packed_page_magnitude           = 0;
+    h->packed_min_word_size            = 0;
+    h->auto_resize                     = false;
+    h->track_occupancy                 = false;
+    h->single_allocation               = false;
+    h->in_buffer                       = false;
+    h->allocator                       = NULL;
 }
 
 int hdr_init(
@@ -334,8 +817,18 @@ int hdr_init(
         int significant_figures,
         struct hdr_histogram** result)
 {
-    int64_t* counts;
-    struct hdr_histogram_bucket_config cfg;
+    return hdr_init_with_allocator(lowest_trackable_value, highest_trackable_value, significant_figures, NULL, result);
+}
+
+int hdr_init_with_allocator(
+        int64_t lowest_trackable_value,
+        int64_t highest_trackable_value,
+        int significant_figures,
+        const struct hdr_allocator* allocator,
+        struct hdr_histogram** result)
+{
+    int64_t* counts;
+    struct hdr_histogram_bucket_config cfg;
     struct hdr_histogram* histogram;
 
     int r = hdr_calculate_bucket_config(lowest_trackable_value, highest_trackable_value, significant_figures, &cfg);
@@ -344,17 +837,213 @@ int hdr_init(
         return r;
     }
 
-    counts = calloc((size_t) cfg.counts_len, sizeof(int64_t));
-    histogram = calloc(1, sizeof(struct hdr_histogram));
+    counts = hdr_allocator_calloc(allocator, (size_t) cfg.counts_len, sizeof(int64_t));
+    histogram = hdr_allocator_calloc(allocator, 1, sizeof(struct hdr_histogram));
 
     if (!counts || !histogram)
     {
+        hdr_allocator_free(allocator, counts);
+        hdr_allocator_free(allocator, histogram);
         return ENOMEM;
     }
 
     histogram->counts = counts;
 
     hdr_init_preallocated(histogram, &cfg);
+    histogram->allocator = allocator;
+    *result = histogram;
+
+    return 0;
+}
+
+static int init_paged(
+        int64_t lowest_trackable_value,
+        int64_t highest_trackable_value,
+        int significant_figures,
+        int32_t max_page_magnitude,
+        int32_t min_word_size,
+        const struct hdr_allocator* allocator,
+        struct hdr_histogram** result)
+{
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_histogram* histogram;
+    struct hdr_packed_page** pages;
+    int32_t page_magnitude;
+
+    int r = hdr_calculate_bucket_config(lowest_trackable_value, highest_trackable_value, significant_figures, &cfg);
+    if (r)
+    {
+        return r;
+    }
+
+    /* Pages never span more than a half bucket, so counts_len is always a whole number of pages. */
+    page_magnitude = cfg.sub_bucket_half_count_magnitude < max_page_magnitude
+        ? cfg.sub_bucket_half_count_magnitude : max_page_magnitude;
+
+    pages = hdr_allocator_calloc(allocator, (size_t) (cfg.counts_len >> page_magnitude), sizeof(struct hdr_packed_page*));
+    histogram = hdr_allocator_calloc(allocator, 1, sizeof(struct hdr_histogram));
+
+    if (!pages || !histogram)
+    {
+        hdr_allocator_free(allocator, pages);
+        hdr_allocator_free(allocator, histogram);
+        return ENOMEM;
+    }
+
+    hdr_init_preallocated(histogram, &cfg);
+    histogram->allocator = allocator;
+    histogram->packed_pages = pages;
+    histogram->packed_page_magnitude = page_magnitude;
+    histogram->packed_min_word_size = min_word_size;
+    *result = histogram;
+
+    return 0;
+}
+
+int hdr_init_packed(
+        int64_t lowest_trackable_value,
+        int64_t highest_trackable_value,
+        int significant_figures,
+        struct hdr_histogram** result)
+{
+    return init_paged(
+        lowest_trackable_value, highest_trackable_value, significant_figures,
+        HDR_PACKED_PAGE_MAGNITUDE, 1, NULL, result);
+}
+
+int hdr_init_paged(
+        int64_t lowest_trackable_value,
+        int64_t highest_trackable_value,
+        int significant_figures,
+        struct hdr_histogram** result)
+{
+    /* One page per half bucket, with full width counts so that recording never widens a page. */
+    return init_paged(
+        lowest_trackable_value, highest_trackable_value, significant_figures,
+        INT32_MAX, (int32_t) sizeof(int64_t), NULL, result);
+}
+
+#define HDR_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+size_t hdr_round_up_to(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+uint8_t* hdr_align_to_cache_line(void* ptr)
+{
+    return (uint8_t*) (((uintptr_t) ptr + HDR_CACHE_LINE_SIZE - 1) & ~(uintptr_t) (HDR_CACHE_LINE_SIZE - 1));
+}
+
+static size_t aligned_header_size(void)
+{
+    return hdr_round_up_to(sizeof(struct hdr_histogram), HDR_CACHE_LINE_SIZE);
+}
+
+static void* aligned_alloc_block(size_t alignment, size_t size)
+{
+#if defined(_MSC_VER)
+    return _aligned_malloc(size, alignment);
+#else
+    void* block;
+    return 0 == posix_memalign(&block, alignment, size) ? block : NULL;
+#endif
+}
+
+static void aligned_free_block(void* block)
+{
+#if defined(_MSC_VER)
+    _aligned_free(block);
+#else
+    free(block);
+#endif
+}
+
+static bool counts_in_allocation(const struct hdr_histogram* h)
+{
+    return (h->single_allocation || h->in_buffer) && (uint8_t*) h->counts == (uint8_t*) h + aligned_header_size();
+}
+
+int hdr_init_aligned(
+        int64_t lowest_trackable_value,
+        int64_t highest_trackable_value,
+        int significant_figures,
+        bool use_huge_pages,
+        struct hdr_histogram** result)
+{
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_histogram* histogram;
+    size_t alignment = HDR_CACHE_LINE_SIZE;
+    size_t size;
+    uint8_t* block;
+
+    int r = hdr_calculate_bucket_config(lowest_trackable_value, highest_trackable_value, significant_figures, &cfg);
+    if (r)
+    {
+        return r;
+    }
+
+    size = aligned_header_size() + (size_t) cfg.counts_len * sizeof(int64_t);
+
+    if (use_huge_pages && size >= HDR_HUGE_PAGE_SIZE)
+    {
+        alignment = HDR_HUGE_PAGE_SIZE;
+        size = hdr_round_up_to(size, HDR_HUGE_PAGE_SIZE);
+    }
+
+    block = aligned_alloc_block(alignment, size);
+    if (!block)
+    {
+        return ENOMEM;
+    }
+
+#if defined(MADV_HUGEPAGE)
+    if (HDR_HUGE_PAGE_SIZE == alignment)
+    {
+        /* Only advisory, the histogram works the same if the kernel declines. */
+        (void) madvise(block, size, MADV_HUGEPAGE);
+    }
+#endif
+
+    memset(block, 0, size);
+
+    histogram = (struct hdr_histogram*) block;
+    histogram->counts = (int64_t*) (block + aligned_header_size());
+    hdr_init_preallocated(histogram, &cfg);
+    histogram->single_allocation = true;
+
+    *result = histogram;
+
+    return 0;
+}
+
+size_t hdr_buffer_size(const struct hdr_histogram_bucket_config* cfg)
+{
+    return aligned_header_size() + (size_t) cfg->counts_len * sizeof(int64_t);
+}
+
+int hdr_init_in_buffer(
+        void* buffer,
+        size_t buffer_len,
+        struct hdr_histogram_bucket_config* cfg,
+        const struct hdr_allocator* allocator,
+        struct hdr_histogram** result)
+{
+    struct hdr_histogram* histogram;
+
+    if (!buffer || buffer_len < hdr_buffer_size(cfg) || 0 != (uintptr_t) buffer % sizeof(int64_t))
+    {
+        return EINVAL;
+    }
+
+    memset(buffer, 0, hdr_buffer_size(cfg));
+
+    histogram = (struct hdr_histogram*) buffer;
+    histogram->counts = (int64_t*) ((uint8_t*) buffer + aligned_header_size());
+    hdr_init_preallocated(histogram, cfg);
+    histogram->in_buffer = true;
+    histogram->allocator = allocator;
+
     *result = histogram;
 
     return 0;
@@ -362,8 +1051,32 @@ int hdr_init(
 
 void hdr_close(struct hdr_histogram* h)
 {
-    free(h->counts);
-    free(h);
+    int32_t i;
+
+    if (h->packed_pages)
+    {
+        for (i = 0; i < packed_page_count(h); i++)
+        {
+            hdr_allocator_free(h->allocator, h->packed_pages[i]);
+        }
+        hdr_allocator_free(h->allocator, h->packed_pages);
+    }
+
+    if (h->single_allocation || h->in_buffer)
+    {
+        if (!counts_in_allocation(h))
+        {
+            hdr_allocator_free(h->allocator, h->counts);
+        }
+        if (h->single_allocation)
+        {
+            aligned_free_block(h);
+        }
+        return;
+    }
+
+    hdr_allocator_free(h->allocator, h->counts);
+    hdr_allocator_free(h->allocator, h);
 }
 
 int hdr_alloc(int64_t highest_trackable_value, int significant_figures, struct hdr_histogram** result)
@@ -371,18 +1084,256 @@ int hdr_alloc(int64_t highest_trackable_value, int significant_figures, struct h
     return hdr_init(1, highest_trackable_value, significant_figures, result);
 }
 
+static void zero_counts_direct(struct hdr_histogram* h, int32_t from, int32_t to)
+{
+    if (h->packed_pages)
+    {
+        int32_t i;
+        for (i = from >> h->packed_page_magnitude; i <= (to - 1) >> h->packed_page_magnitude; i++)
+        {
+            struct hdr_packed_page* page = h->packed_pages[i];
+            if (page)
+            {
+                memset(page + 1, 0, (size_t) packed_page_len(h) * (size_t) page->word_size);
+            }
+        }
+        return;
+    }
+
+    memset(&h->counts[from], 0, sizeof(int64_t) * (size_t) (to - from));
+    if (h->track_occupancy)
+    {
+        memset(&occupancy_of(h)[from >> 6], 0, sizeof(uint64_t) * (size_t) (((to - 1) >> 6) - (from >> 6) + 1));
+    }
+}
+
+/* Zeroes the logical indexes lowest..highest (inclusive), which may wrap around the array. */
+static void zero_counts_normalised(struct hdr_histogram* h, int32_t lowest, int32_t highest)
+{
+    int32_t from, to;
+
+    if (lowest > highest)
+    {
+        return;
+    }
+
+    from = normalize_index(h, lowest);
+    to = normalize_index(h, highest);
+
+    if (from <= to)
+    {
+        zero_counts_direct(h, from, to + 1);
+    }
+    else
+    {
+        zero_counts_direct(h, from, h->counts_len);
+        zero_counts_direct(h, 0, to + 1);
+    }
+}
+
 /* reset a histogram to zero. */
 void hdr_reset(struct hdr_histogram *h)
 {
+     int32_t lowest, highest;
+
+     /* Only the touched range (and the zero value's index) can hold counts. */
+     hdr_counts_touched_range(h, &lowest, &highest);
+     zero_counts_normalised(h, 0, 0);
+     zero_counts_normalised(h, lowest, highest);
+
      h->total_count=0;
      h->min_value = INT64_MAX;
      h->max_value = 0;
-     memset(h->counts, 0, (sizeof(int64_t) * h->counts_len));
+     h->moments_sum = 0.0;
+     h->moments_sum_of_squares = 0.0;
+     h->normalizing_index_offset = 0;
+}
+
+void hdr_set_running_moments(struct hdr_histogram* h, bool enabled)
+{
+    if (enabled && !h->running_moments)
+    {
+        reset_moments(h);
+    }
+
+    h->running_moments = enabled;
+}
+
+void hdr_set_auto_resize(struct hdr_histogram* h, bool enabled)
+{
+    h->auto_resize = enabled;
+}
+
+int hdr_set_occupancy_tracking(struct hdr_histogram* h, bool enabled)
+{
+    int64_t* counts;
+    int32_t words;
+
+    if (h->packed_pages)
+    {
+        return EINVAL;
+    }
+
+    if (!enabled || h->track_occupancy)
+    {
+        h->track_occupancy = enabled;
+        return 0;
+    }
+
+    /* The bitmap goes after the counts, so they move to a larger allocation. */
+    words = occupancy_words(h->counts_len);
+    if (counts_in_allocation(h))
+    {
+        counts = hdr_allocator_malloc(h->allocator, (size_t) (h->counts_len + words) * sizeof(int64_t));
+        if (counts)
+        {
+            memcpy(counts, h->counts, (size_t) h->counts_len * sizeof(int64_t));
+        }
+    }
+    else
+    {
+        counts = allocator_realloc(
+            h->allocator, h->counts,
+            (size_t) h->counts_len * sizeof(int64_t),
+            (size_t) (h->counts_len + words) * sizeof(int64_t));
+    }
+
+    if (!counts)
+    {
+        return ENOMEM;
+    }
+
+    h->counts = counts;
+    h->track_occupancy = true;
+    occupancy_rebuild(h);
+
+    return 0;
+}
+
+/*
+ * Grows the histogram so that it covers 'value'.  The bucket layout does not depend
+ * on the number of buckets, so existing counts keep their indexes, except that when
+ * the counts are normalised the part from the normalised zero index to the end of
+ * the array has to move up to the new end.  A negative offset is first rewritten as
+ * the equivalent positive one, which describes the same layout for the old length
+ * and keeps the wrapped counts below the zero index where they belong.
+ */
+static bool resize(struct hdr_histogram* h, int64_t value)
+{
+    int32_t bucket_count = buckets_needed_to_cover_value(value, h->sub_bucket_count, h->unit_magnitude);
+    int32_t counts_len = (bucket_count + 1) * h->sub_bucket_half_count;
+    int32_t zero_index = normalize_index(h, 0);
+    int32_t delta = counts_len - h->counts_len;
+
+    if (delta <= 0)
+    {
+        return true;
+    }
+
+    if (h->normalizing_index_offset < 0)
+    {
+        h->normalizing_index_offset += h->counts_len;
+    }
+
+    if (h->packed_pages)
+    {
+        int32_t page_count = counts_len >> h->packed_page_magnitude;
+        int32_t page_delta = delta >> h->packed_page_magnitude;
+        int32_t zero_page = zero_index >> h->packed_page_magnitude;
+        struct hdr_packed_page** pages = allocator_realloc(
+            h->allocator, h->packed_pages,
+            (size_t) packed_page_count(h) * sizeof(struct hdr_packed_page*),
+            (size_t) page_count * sizeof(struct hdr_packed_page*));
+
+        if (!pages)
+        {
+            return false;
+        }
+
+        memset(&pages[page_count - page_delta], 0, (size_t) page_delta * sizeof(struct hdr_packed_page*));
+        if (0 != zero_index)
+        {
+            memmove(
+                &pages[zero_page + page_delta], &pages[zero_page],
+                (size_t) (page_count - page_delta - zero_page) * sizeof(struct hdr_packed_page*));
+            memset(&pages[zero_page], 0, (size_t) page_delta * sizeof(struct hdr_packed_page*));
+        }
+
+        h->packed_pages = pages;
+    }
+    else
+    {
+        int64_t* counts;
+        int32_t old_words = h->track_occupancy ? occupancy_words(h->counts_len) : 0;
+        int32_t words = h->track_occupancy ? occupancy_words(counts_len) : 0;
+
+        /* Counts sharing the header's block can't be reallocated, they move out to their own. */
+        if (counts_in_allocation(h))
+        {
+            counts = hdr_allocator_malloc(h->allocator, (size_t) (counts_len + words) * sizeof(int64_t));
+            if (counts)
+            {
+                memcpy(counts, h->counts, (size_t) h->counts_len * sizeof(int64_t));
+            }
+        }
+        else
+        {
+            counts = allocator_realloc(
+                h->allocator, h->counts,
+                (size_t) (h->counts_len + old_words) * sizeof(int64_t),
+                (size_t) (counts_len + words) * sizeof(int64_t));
+        }
+
+        if (!counts)
+        {
+            return false;
+        }
+
+        memset(&counts[h->counts_len], 0, (size_t) delta * sizeof(int64_t));
+        if (0 != zero_index)
+        {
+            memmove(
+                &counts[zero_index + delta], &counts[zero_index],
+                (size_t) (h->counts_len - zero_index) * sizeof(int64_t));
+            memset(&counts[zero_index], 0, (size_t) delta * sizeof(int64_t));
+        }
+
+        h->counts = counts;
+    }
+
+    h->bucket_count = bucket_count;
+    h->counts_len = counts_len;
+    h->highest_trackable_value = value > h->highest_trackable_value ? value : h->highest_trackable_value;
+
+    if (h->counts && h->track_occupancy)
+    {
+        occupancy_rebuild(h);
+    }
+
+    return true;
 }
 
 size_t hdr_get_memory_size(struct hdr_histogram *h)
 {
-    return sizeof(struct hdr_histogram) + h->counts_len * sizeof(int64_t);
+    size_t size;
+    int32_t i;
+
+    if (!h->packed_pages)
+    {
+        size = sizeof(struct hdr_histogram) + h->counts_len * sizeof(int64_t);
+        return h->track_occupancy ? size + (size_t) occupancy_words(h->counts_len) * sizeof(uint64_t) : size;
+    }
+
+    size = sizeof(struct hdr_histogram) + (size_t) packed_page_count(h) * sizeof(struct hdr_packed_page*);
+    for (i = 0; i < packed_page_count(h); i++)
+    {
+        if (h->packed_pages[i])
+        {
+            size += packed_page_size(h, h->packed_pages[i]->word_size);
+        }
+    }
+
+    return size;
 }
 
 /* ##     ## ########  ########     ###    ######## ########  ######  */
@@ -411,49 +1362,424 @@ bool hdr_record_values(struct hdr_histogram* h, int64_t value, int64_t count)
     counts_index = counts_index_for(h, value);
 
     if (counts_index < 0 || h->counts_len <= counts_index)
+    {
+        if (!h->auto_resize || counts_index < 0 || !resize(h, value))
+        {
+            return false;
+        }
+    }
+
+    if (!counts_inc_normalised(h, counts_index, count))
     {
         return false;
     }
+    update_min_max(h, value);
+
+    if (h->running_moments)
+    {
+        update_moments(h, value, count);
+    }
+
+    return true;
+}
+
+#define HDR_BATCH_BLOCK_SIZE 64
+
+static int64_t record_values_batch(
+    struct hdr_histogram* h, const int64_t* values, const int64_t* counts, size_t length)
+{
+    int32_t indexes[HDR_BATCH_BLOCK_SIZE];
+    int64_t dropped = 0;
+    size_t offset = 0;
+
+    while (offset < length)
+    {
+        size_t block_len = (length - offset) < HDR_BATCH_BLOCK_SIZE ? (length - offset) : HDR_BATCH_BLOCK_SIZE;
+        const int64_t* block = &values[offset];
+        int64_t block_min = 0;
+        int64_t block_max = 0;
+        int64_t block_total = 0;
+        size_t i;
+
+        /* Compute all of the indexes first, this loop has no data dependencies between iterations. */
+        for (i = 0; i < block_len; i++)
+        {
+            indexes[i] = counts_index_for(h, block[i] < 0 ? 0 : block[i]);
+        }
+
+        for (i = 0; i < block_len; i++)
+        {
+            int64_t value = block[i];
+            int64_t count = counts ? counts[offset + i] : 1;
+
+            if (h->auto_resize && value >= 0 && h->counts_len <= indexes[i])
+            {
+                resize(h, value);
+            }
+
+            if (value < 0 || h->counts_len <= indexes[i] ||
+                !counts_add_direct(h, normalize_index(h, indexes[i]), count))
+            {
+                dropped += count;
+                continue;
+            }
+
+            block_total += count;
+            if (h->running_moments)
+            {
+                update_moments(h, value, count);
+            }
+            block_min = (value != 0 && (0 == block_min || value < block_min)) ? value : block_min;
+            block_max = (value > block_max) ? value : block_max;
+        }
+
+        /* A block that recorded nothing has no min or max to apply, and one that
+         * recorded only zeros has no non-zero min. */
+        if (0 != block_total)
+        {
+            h->total_count += block_total;
+            if (0 != block_min)
+            {
+                update_min_max(h, block_min);
+            }
+            update_min_max(h, block_max);
+        }
+
+        offset += block_len;
+    }
+
+    return dropped;
+}
+
+int64_t hdr_record_values_batch(struct hdr_histogram* h, const int64_t* values, size_t length)
+{
+    return record_values_batch(h, values, NULL, length);
+}
+
+int64_t hdr_record_values_batch_with_counts(
+    struct hdr_histogram* h, const int64_t* values, const int64_t* counts, size_t length)
+{
+    return record_values_batch(h, values, counts, length);
+}
+
+bool hdr_record_value_atomic(struct hdr_histogram* h, int64_t value)
+{
+    return hdr_record_values_atomic(h, value, 1);
+}
+
+bool hdr_record_values_atomic(struct hdr_histogram* h, int64_t value, int64_t count)
+{
+    int32_t counts_index;
+
+    if (value < 0)
+    {
+        return false;
+    }
+
+    counts_index = counts_index_for(h, value);
+
+    if (counts_index < 0 || h->counts_len <= counts_index || !h->counts)
+    {
+        return false;
+    }
+
+    counts_inc_normalised_atomic(h, counts_index, count);
+    update_min_max_atomic(h, value);
+
+    if (h->running_moments)
+    {
+        update_moments_atomic(h, value, count);
+    }
+
+    return true;
+}
+
+bool hdr_record_corrected_value(struct hdr_histogram* h, int64_t value, int64_t expected_interval)
+{
+    return hdr_record_corrected_values(h, value, 1, expected_interval);
+}
+
+
+/*
+ * Records 'count' of each of the missing values (value - n * expected_interval) that
+ * are >= expected_interval.  Rather than recording the missing values one at a time
+ * it counts how many of them land in each bucket, so the cost is proportional to the
+ * number of buckets touched rather than value / expected_interval.  The caller must
+ * already have recorded 'value', which guarantees all of the missing values are in range.
+ */
+static void record_missing_values(
+    struct hdr_histogram* h, int64_t value, int64_t count, int64_t expected_interval, bool atomic)
+{
+    int64_t missing_value = value - expected_interval;
+    int64_t lowest_missing_value = missing_value;
+
+    /* Nothing is missing, so there is no new min to record either. */
+    if (missing_value < expected_interval)
+    {
+        return;
+    }
+
+    while (missing_value >= expected_interval)
+    {
+        int64_t lowest_in_bucket = lowest_equivalent_value(h, missing_value);
+        int64_t floor_value = lowest_in_bucket > expected_interval ? lowest_in_bucket : expected_interval;
+        int64_t values_in_bucket = (missing_value - floor_value) / expected_interval + 1;
+        int32_t index = counts_index_for(h, missing_value);
+
+        if (atomic)
+        {
+            counts_inc_normalised_atomic(h, index, values_in_bucket * count);
+            if (h->running_moments)
+            {
+                update_moments_atomic(h, missing_value, values_in_bucket * count);
+            }
+        }
+        else
+        {
+            counts_inc_normalised(h, index, values_in_bucket * count);
+            if (h->running_moments)
+            {
+                update_moments(h, missing_value, values_in_bucket * count);
+            }
+        }
+
+        lowest_missing_value = missing_value - (values_in_bucket - 1) * expected_interval;
+        missing_value = lowest_missing_value - expected_interval;
+    }
+
+    if (atomic)
+    {
+        update_min_max_atomic(h, lowest_missing_value);
+    }
+    else
+    {
+        update_min_max(h, lowest_missing_value);
+    }
+}
+
+bool hdr_record_corrected_values(struct hdr_histogram* h, int64_t value, int64_t count, int64_t expected_interval)
+{
+    if (!hdr_record_values(h, value, count))
+    {
+        return false;
+    }
+
+    if (expected_interval <= 0 || value <= expected_interval)
+    {
+        return true;
+    }
+
+    record_missing_values(h, value, count, expected_interval, false);
+
+    return true;
+}
+
+bool hdr_record_corrected_value_atomic(struct hdr_histogram* h, int64_t value, int64_t expected_interval)
+{
+    return hdr_record_corrected_values_atomic(h, value, 1, expected_interval);
+}
+
+bool hdr_record_corrected_values_atomic(struct hdr_histogram* h, int64_t value, int64_t count, int64_t expected_interval)
+{
+    if (!hdr_record_values_atomic(h, value, count))
+    {
+        return false;
+    }
+
+    if (expected_interval <= 0 || value <= expected_interval)
+    {
+        return true;
+    }
+
+    record_missing_values(h, value, count, expected_interval, true);
+
+    return true;
+}
+
+static bool has_same_layout(const struct hdr_histogram* h, const struct hdr_histogram* from)
+{
+    return h->counts && from->counts &&
+        h->unit_magnitude == from->unit_magnitude &&
+        h->sub_bucket_half_count_magnitude == from->sub_bucket_half_count_magnitude &&
+        0 == h->normalizing_index_offset &&
+        0 == from->normalizing_index_offset;
+}
+
+/*
+ * Adds the counts arrays directly when both histograms share the same index layout.
+ * Returns false if 'from' holds values beyond the end of 'h', in which case nothing
+ * has been added and the caller needs to take the slow path.
+ */
+static bool add_same_layout(struct hdr_histogram* h, const struct hdr_histogram* from)
+{
+    int32_t counts_limit, lowest, highest, i;
+    int64_t* counts;
+    const int64_t* from_counts;
+    int64_t added = 0;
+
+    if (0 == from->total_count)
+    {
+        return true;
+    }
+
+    hdr_counts_touched_range(from, &lowest, &highest);
+    counts_limit = highest + 1;
+
+    if (h->counts_len < counts_limit && !(h->auto_resize && resize(h, from->max_value)))
+    {
+        return false;
+    }
+
+    counts = h->counts;
+    from_counts = from->counts;
+
+    counts[0] += from_counts[0];
+    added += from_counts[0];
+    if (h->track_occupancy)
+    {
+        occupancy_mark(h, 0);
+    }
+
+    for (i = next_occupied_index(from, lowest > 1 ? lowest : 1); i < counts_limit; i = next_occupied_index(from, i + 1))
+    {
+        counts[i] += from_counts[i];
+        added += from_counts[i];
+        if (h->track_occupancy)
+        {
+            occupancy_mark(h, i);
+        }
+    }
+
+    h->total_count += added;
+
+    if (h->running_moments && from->running_moments)
+    {
+        h->moments_sum += from->moments_sum;
+        h->moments_sum_of_squares += from->moments_sum_of_squares;
+    }
+    else if (h->running_moments)
+    {
+        for (i = 0; i < counts_limit; i++)
+        {
+            if (0 != from_counts[i])
+            {
+                update_moments(h, hdr_value_at_index(h, i), from_counts[i]);
+            }
+        }
+    }
+
+    if (INT64_MAX != from->min_value)
+    {
+        update_min_max(h, from->min_value);
+    }
+    update_min_max(h, from->max_value);
+
+    return true;
+}
+
+int64_t hdr_add(struct hdr_histogram* h, const struct hdr_histogram* from)
+{
+    struct hdr_iter iter;
+    int64_t dropped = 0;
+
+    if (has_same_layout(h, from) && add_same_layout(h, from))
+    {
+        return 0;
+    }
+
+    hdr_iter_recorded_init(&iter, from);
+
+    while (hdr_iter_next(&iter))
+    {
+        int64_t value = iter.value;
+        int64_t count = iter.count;
+
+        if (!hdr_record_values(h, value, count))
+        {
+            dropped += count;
+        }
+    }
+
+    return dropped;
+}
+
+/* Recomputes min and max after counts were removed, only looking inside the old range. */
+static void update_min_max_from_counts(struct hdr_histogram* h)
+{
+    int32_t lowest, highest, i;
+    int32_t min_index = -1;
+    int32_t max_index = 0 < counts_get_normalised(h, 0) ? 0 : -1;
+
+    hdr_counts_touched_range(h, &lowest, &highest);
+
+    for (i = next_occupied_index(h, lowest > 1 ? lowest : 1); i <= highest; i = next_occupied_index(h, i + 1))
+    {
+        if (0 < counts_get_normalised(h, i))
+        {
+            min_index = -1 == min_index ? i : min_index;
+            max_index = i;
+        }
+    }
 
-    counts_inc_normalised(h, counts_index, count);
-    update_min_max(h, value);
-
-    return true;
+    h->min_value = -1 == min_index ? INT64_MAX : hdr_value_at_index(h, min_index);
+    h->max_value = -1 == max_index ? 0 : highest_equivalent_value(h, hdr_value_at_index(h, max_index));
 }
 
-bool hdr_record_corrected_value(struct hdr_histogram* h, int64_t value, int64_t expected_interval)
+int hdr_subtract(struct hdr_histogram* h, const struct hdr_histogram* from)
 {
-    return hdr_record_corrected_values(h, value, 1, expected_interval);
-}
-
+    struct hdr_iter iter;
+    int64_t steps = 0;
+    int rc = 0;
 
-bool hdr_record_corrected_values(struct hdr_histogram* h, int64_t value, int64_t count, int64_t expected_interval)
-{
-    int64_t missing_value;
+    hdr_iter_recorded_init(&iter, from);
 
-    if (!hdr_record_values(h, value, count))
+    while (hdr_iter_next(&iter))
     {
-        return false;
+        int32_t index = counts_index_for(h, iter.value);
+
+        if (index < 0 || h->counts_len <= index || counts_get_normalised(h, index) < iter.count)
+        {
+            rc = EINVAL;
+            break;
+        }
+
+        counts_inc_normalised(h, index, -iter.count);
+        steps++;
     }
 
-    if (expected_interval <= 0 || value <= expected_interval)
+    if (0 != rc)
     {
-        return true;
+        /* Put back what was already taken, leaving h as it was. */
+        hdr_iter_recorded_init(&iter, from);
+        while (0 < steps-- && hdr_iter_next(&iter))
+        {
+            counts_inc_normalised(h, counts_index_for(h, iter.value), iter.count);
+        }
+
+        return rc;
     }
 
-    missing_value = value - expected_interval;
-    for (; missing_value >= expected_interval; missing_value -= expected_interval)
+    if (h->running_moments && from->running_moments)
+    {
+        h->moments_sum -= from->moments_sum;
+        h->moments_sum_of_squares -= from->moments_sum_of_squares;
+    }
+    else if (h->running_moments)
     {
-        if (!hdr_record_values(h, missing_value, count))
+        hdr_iter_recorded_init(&iter, from);
+        while (hdr_iter_next(&iter))
         {
-            return false;
+            update_moments(h, hdr_value_at_index(h, counts_index_for(h, iter.value)), -iter.count);
         }
     }
 
-    return true;
+    update_min_max_from_counts(h);
+
+    return 0;
 }
 
-int64_t hdr_add(struct hdr_histogram* h, const struct hdr_histogram* from)
+int64_t hdr_add_while_correcting_for_coordinated_omission(
+        struct hdr_histogram* h, struct hdr_histogram* from, int64_t expected_interval)
 {
     struct hdr_iter iter;
     int64_t dropped = 0;
@@ -464,7 +1790,7 @@ int64_t hdr_add(struct hdr_histogram* h, const struct hdr_histogram* from)
         int64_t value = iter.value;
         int64_t count = iter.count;
 
-        if (!hdr_record_values(h, value, count))
+        if (!hdr_record_corrected_values(h, value, count, expected_interval))
         {
             dropped += count;
         }
@@ -473,25 +1799,142 @@ int64_t hdr_add(struct hdr_histogram* h, const struct hdr_histogram* from)
     return dropped;
 }
 
-int64_t hdr_add_while_correcting_for_coordinated_omission(
-        struct hdr_histogram* h, struct hdr_histogram* from, int64_t expected_interval)
+/*
+ * The counts in the lowest half bucket (other than the zero value) are the only ones that
+ * cannot be moved by changing the normalizing offset, so they are re-recorded at their
+ * shifted values.  Everything below the current lowest half bucket is known to be empty and
+ * each count moves to a lower index than any count not yet moved, so one pass is enough.
+ */
+static void shift_lowest_half_bucket_contents_left(
+    struct hdr_histogram* h, int32_t binary_orders_of_magnitude, int32_t pre_shift_zero_index)
 {
-    struct hdr_iter iter;
-    int64_t dropped = 0;
-    hdr_iter_recorded_init(&iter, from);
+    int32_t from_index;
 
-    while (hdr_iter_next(&iter))
+    for (from_index = 1; from_index < h->sub_bucket_half_count; from_index++)
     {
-        int64_t value = iter.value;
-        int64_t count = iter.count;
+        int64_t to_value = hdr_value_at_index(h, from_index) << binary_orders_of_magnitude;
+        int32_t to_index = normalize_index(h, counts_index_for(h, to_value));
+        int32_t from_raw_index = from_index + pre_shift_zero_index;
+        int64_t count;
 
-        if (!hdr_record_corrected_values(h, value, count, expected_interval))
+        if (from_raw_index >= h->counts_len)
         {
-            dropped += count;
+            from_raw_index -= h->counts_len;
         }
+
+        count = counts_get_direct(h, from_raw_index);
+        counts_set_direct(h, to_index, count);
+        counts_set_direct(h, from_raw_index, 0);
     }
+}
 
-    return dropped;
+static void shift_normalizing_index_by_offset(
+    struct hdr_histogram* h, int32_t offset_to_add, bool lowest_half_bucket_populated, int32_t binary_orders_of_magnitude)
+{
+    int64_t zero_value_count = counts_get_normalised(h, 0);
+    int32_t pre_shift_zero_index = normalize_index(h, 0);
+
+    counts_set_direct(h, pre_shift_zero_index, 0);
+
+    h->normalizing_index_offset += offset_to_add;
+
+    if (lowest_half_bucket_populated)
+    {
+        shift_lowest_half_bucket_contents_left(h, binary_orders_of_magnitude, pre_shift_zero_index);
+    }
+
+    counts_set_direct(h, normalize_index(h, 0), zero_value_count);
+}
+
+static void scale_moments(struct hdr_histogram* h, double multiplier)
+{
+    h->moments_sum *= multiplier;
+    h->moments_sum_of_squares *= multiplier * multiplier;
+}
+
+int hdr_shift_values_left(struct hdr_histogram* h, int32_t binary_orders_of_magnitude)
+{
+    int32_t shift_amount;
+    int64_t max_value, min_value;
+    bool lowest_half_bucket_populated;
+
+    if (binary_orders_of_magnitude < 0)
+    {
+        return EINVAL;
+    }
+
+    if (h->total_count == counts_get_normalised(h, 0))
+    {
+        return 0;
+    }
+
+    shift_amount = binary_orders_of_magnitude << h->sub_bucket_half_count_magnitude;
+
+    if (binary_orders_of_magnitude >= h->bucket_count ||
+        counts_index_for(h, h->max_value) >= h->counts_len - shift_amount)
+    {
+        return ERANGE;
+    }
+
+    max_value = h->max_value;
+    min_value = h->min_value;
+    lowest_half_bucket_populated = min_value < ((int64_t) h->sub_bucket_half_count << h->unit_magnitude);
+
+    shift_normalizing_index_by_offset(h, shift_amount, lowest_half_bucket_populated, binary_orders_of_magnitude);
+
+    h->max_value = 0;
+    h->min_value = INT64_MAX;
+    update_min_max(h, max_value << binary_orders_of_magnitude);
+    update_min_max(h, min_value << binary_orders_of_magnitude);
+
+    if (h->running_moments)
+    {
+        scale_moments(h, (double) (INT64_C(1) << binary_orders_of_magnitude));
+    }
+
+    return 0;
+}
+
+int hdr_shift_values_right(struct hdr_histogram* h, int32_t binary_orders_of_magnitude)
+{
+    int32_t shift_amount;
+    int64_t max_value, min_value;
+
+    if (binary_orders_of_magnitude < 0)
+    {
+        return EINVAL;
+    }
+
+    if (h->total_count == counts_get_normalised(h, 0))
+    {
+        return 0;
+    }
+
+    shift_amount = binary_orders_of_magnitude << h->sub_bucket_half_count_magnitude;
+
+    /* Shifting any non-zero value into the lowest half bucket would lose precision. */
+    if (binary_orders_of_magnitude >= h->bucket_count ||
+        counts_index_for(h, h->min_value) < shift_amount + h->sub_bucket_half_count)
+    {
+        return ERANGE;
+    }
+
+    max_value = h->max_value;
+    min_value = h->min_value;
+
+    shift_normalizing_index_by_offset(h, -shift_amount, false, binary_orders_of_magnitude);
+
+    h->max_value = 0;
+    h->min_value = INT64_MAX;
+    update_min_max(h, max_value >> binary_orders_of_magnitude);
+    update_min_max(h, min_value >> binary_orders_of_magnitude);
+
+    if (h->running_moments)
+    {
+        scale_moments(h, 1.0 / (double) (INT64_C(1) << binary_orders_of_magnitude));
+    }
+
+    return 0;
 }
 
 
@@ -525,16 +1968,21 @@ int64_t hdr_min(const struct hdr_histogram* h)
     return non_zero_min(h);
 }
 
+static int64_t count_at_percentile_for(int64_t total_count, double percentile)
+{
+    double requested_percentile = percentile < 100.0 ? percentile : 100.0;
+    int64_t count_at_percentile =
+        (int64_t) (((requested_percentile / 100) * total_count) + 0.5);
+    return count_at_percentile > 1 ? count_at_percentile : 1;
+}
+
 int64_t hdr_value_at_percentile(const struct hdr_histogram* h, double percentile)
 {
     struct hdr_iter iter;
     int64_t total = 0;
-    double requested_percentile = percentile < 100.0 ? percentile : 100.0;
-    int64_t count_at_percentile =
-        (int64_t) (((requested_percentile / 100) * h->total_count) + 0.5);
-    count_at_percentile = count_at_percentile > 1 ? count_at_percentile : 1;
+    int64_t count_at_percentile = count_at_percentile_for(h->total_count, percentile);
 
-    hdr_iter_init(&iter, h);
+    hdr_iter_recorded_init(&iter, h);
 
     while (hdr_iter_next(&iter))
     {
@@ -550,12 +1998,71 @@ int64_t hdr_value_at_percentile(const struct hdr_histogram* h, double percentile
     return 0;
 }
 
+int hdr_value_at_percentiles(
+    const struct hdr_histogram* h, const double* percentiles, int64_t* values, size_t length)
+{
+    struct hdr_iter iter;
+    int64_t total = 0;
+    int64_t count_at_percentile;
+    size_t at_pos;
+
+    if (NULL == percentiles || NULL == values)
+    {
+        return EINVAL;
+    }
+
+    for (at_pos = 1; at_pos < length; at_pos++)
+    {
+        if (percentiles[at_pos] < percentiles[at_pos - 1])
+        {
+            return EINVAL;
+        }
+    }
+
+    at_pos = 0;
+
+    if (0 < length && 0 < h->total_count)
+    {
+        count_at_percentile = count_at_percentile_for(h->total_count, percentiles[0]);
+
+        hdr_iter_recorded_init(&iter, h);
+
+        while (at_pos < length && hdr_iter_next(&iter))
+        {
+            total += iter.count;
+
+            while (at_pos < length && total >= count_at_percentile)
+            {
+                values[at_pos] = highest_equivalent_value(h, iter.value);
+                at_pos++;
+
+                if (at_pos < length)
+                {
+                    count_at_percentile = count_at_percentile_for(h->total_count, percentiles[at_pos]);
+                }
+            }
+        }
+    }
+
+    for (; at_pos < length; at_pos++)
+    {
+        values[at_pos] = 0;
+    }
+
+    return 0;
+}
+
 double hdr_mean(const struct hdr_histogram* h)
 {
     struct hdr_iter iter;
     int64_t total = 0;
 
-    hdr_iter_init(&iter, h);
+    if (h->running_moments)
+    {
+        return h->moments_sum / h->total_count;
+    }
+
+    hdr_iter_recorded_init(&iter, h);
 
     while (hdr_iter_next(&iter))
     {
@@ -574,7 +2081,14 @@ double hdr_stddev(const struct hdr_histogram* h)
     double geometric_dev_total = 0.0;
 
     struct hdr_iter iter;
-    hdr_iter_init(&iter, h);
+
+    if (h->running_moments)
+    {
+        double variance = (h->moments_sum_of_squares / h->total_count) - (mean * mean);
+        return sqrt(variance > 0.0 ? variance : 0.0);
+    }
+
+    hdr_iter_recorded_init(&iter, h);
 
     while (hdr_iter_next(&iter))
     {
@@ -608,6 +2122,158 @@ int64_t hdr_count_at_index(const struct hdr_histogram* h, int32_t index)
     return counts_get_normalised(h, index);
 }
 
+static int32_t counts_limit_for(const struct hdr_histogram* h)
+{
+    int32_t len_to_max = counts_index_for(h, h->max_value) + 1;
+    return len_to_max < h->counts_len ? len_to_max : h->counts_len;
+}
+
+int hdr_cumulative_index_init(struct hdr_cumulative_index* index, const struct hdr_histogram* h)
+{
+    index->h = h;
+    index->capacity = h->counts_len;
+    index->length = 0;
+    index->total_count = -1;
+    index->cumulative_counts = hdr_allocator_calloc(h->allocator, (size_t) h->counts_len, sizeof(int64_t));
+
+    return index->cumulative_counts ? 0 : ENOMEM;
+}
+
+void hdr_cumulative_index_destroy(struct hdr_cumulative_index* index)
+{
+    hdr_allocator_free(index->h->allocator, index->cumulative_counts);
+    index->cumulative_counts = NULL;
+}
+
+int hdr_cumulative_index_refresh(struct hdr_cumulative_index* index)
+{
+    const struct hdr_histogram* h = index->h;
+    int64_t cumulative_count = 0;
+    int32_t counts_limit, i;
+
+    if (index->capacity < h->counts_len)
+    {
+        int64_t* cumulative_counts = allocator_realloc(
+            h->allocator, index->cumulative_counts,
+            sizeof(int64_t) * (size_t) index->capacity, sizeof(int64_t) * (size_t) h->counts_len);
+        if (!cumulative_counts)
+        {
+            return ENOMEM;
+        }
+
+        index->cumulative_counts = cumulative_counts;
+        index->capacity = h->counts_len;
+    }
+
+    counts_limit = counts_limit_for(h);
+    for (i = 0; i < counts_limit; i++)
+    {
+        cumulative_count += counts_get_normalised(h, i);
+        index->cumulative_counts[i] = cumulative_count;
+    }
+
+    index->length = counts_limit;
+    index->total_count = h->total_count;
+
+    return 0;
+}
+
+static int refresh_if_stale(struct hdr_cumulative_index* index)
+{
+    return index->total_count == index->h->total_count ? 0 : hdr_cumulative_index_refresh(index);
+}
+
+/* Find the first index with a cumulative count >= count. */
+static int32_t cumulative_index_search(const struct hdr_cumulative_index* index, int64_t count)
+{
+    int32_t low = 0;
+    int32_t high = index->length;
+
+    while (low < high)
+    {
+        int32_t mid = low + ((high - low) >> 1);
+
+        if (index->cumulative_counts[mid] < count)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+static int64_t cumulative_index_value_at_percentile(const struct hdr_cumulative_index* index, double percentile)
+{
+    int64_t count = count_at_percentile_for(index->total_count, percentile);
+    int32_t i = cumulative_index_search(index, count);
+
+    if (i >= index->length)
+    {
+        return 0;
+    }
+
+    return highest_equivalent_value(index->h, hdr_value_at_index(index->h, i));
+}
+
+int64_t hdr_cumulative_index_value_at_percentile(struct hdr_cumulative_index* index, double percentile)
+{
+    if (refresh_if_stale(index))
+    {
+        return 0;
+    }
+
+    return cumulative_index_value_at_percentile(index, percentile);
+}
+
+int hdr_cumulative_index_values_at_percentiles(
+    struct hdr_cumulative_index* index, const double* percentiles, int64_t* values, size_t length)
+{
+    size_t i;
+    int rc;
+
+    if (NULL == percentiles || NULL == values)
+    {
+        return EINVAL;
+    }
+
+    if ((rc = refresh_if_stale(index)) != 0)
+    {
+        return rc;
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        values[i] = cumulative_index_value_at_percentile(index, percentiles[i]);
+    }
+
+    return 0;
+}
+
+int64_t hdr_cumulative_index_count_between(struct hdr_cumulative_index* index, int64_t low, int64_t high)
+{
+    int32_t low_index, high_index;
+
+    if (refresh_if_stale(index) || low > high || high < 0 || 0 == index->length)
+    {
+        return 0;
+    }
+
+    low_index = low > 0 ? counts_index_for(index->h, low) : 0;
+    high_index = counts_index_for(index->h, high);
+    high_index = high_index < index->length ? high_index : index->length - 1;
+
+    if (low_index > high_index)
+    {
+        return 0;
+    }
+
+    return index->cumulative_counts[high_index] - (low_index > 0 ? index->cumulative_counts[low_index - 1] : 0);
+}
+
 
 /* #### ######## ######## ########     ###    ########  #######  ########   ######  */
 /*  ##     ##    ##       ##     ##   ## ##      ##    ##     ## ##     ## ##    ## */
@@ -664,6 +2330,35 @@ static bool next_value_greater_than_reporting_level_upper_bound(
     return peek_next_value_from_index(iter) > reporting_level_upper_bound;
 }
 
+/*
+ * Moves the iterator to just before the next index that may hold a count, but no
+ * further than just before 'limit', so move_next lands on the earlier of the two.
+ */
+static void skip_to_occupied(struct hdr_iter* iter, int32_t limit)
+{
+    int32_t next = next_occupied_index(iter->h, iter->counts_index + 1);
+    next = next < limit ? next : limit;
+
+    if (next - 1 > iter->counts_index)
+    {
+        iter->counts_index = next - 1;
+    }
+}
+
+/* The index of the first value at or above a reporting level, which must not be skipped. */
+static int32_t reporting_level_index(const struct hdr_iter* iter, int64_t reporting_level_lowest_equivalent)
+{
+    int32_t index;
+
+    if (reporting_level_lowest_equivalent <= 0)
+    {
+        return iter->counts_index + 1;
+    }
+
+    index = counts_index_for(iter->h, reporting_level_lowest_equivalent);
+    return index < iter->h->counts_len ? index : iter->h->counts_len;
+}
+
 static bool _basic_iter_next(struct hdr_iter *iter)
 {
     if (!has_next(iter) || iter->counts_index >= iter->h->counts_len)
@@ -671,9 +2366,16 @@ static bool _basic_iter_next(struct hdr_iter *iter)
         return false;
     }
 
-    move_next(iter);
+    /* Nothing between the zero value's index and the min can hold counts. */
+    if (0 == iter->counts_index && INT64_MAX != iter->h->min_value)
+    {
+        int32_t lowest = counts_index_for(iter->h, iter->h->min_value);
+        iter->counts_index = lowest > 0 ? lowest - 1 : 0;
+    }
+
+    skip_to_occupied(iter, iter->h->counts_len);
 
-    return true;
+    return move_next(iter);
 }
 
 static void _update_iterated_values(struct hdr_iter* iter, int64_t new_value_iterated_to)
@@ -876,6 +2578,9 @@ static bool _iter_linear_next(struct hdr_iter* iter)
                 return true;
             }
 
+            skip_to_occupied(
+                iter, reporting_level_index(iter, linear->next_value_reporting_level_lowest_equivalent));
+
             if (!move_next(iter))
             {
                 return true;
@@ -932,6 +2637,9 @@ static bool _log_iter_next(struct hdr_iter *iter)
                 return true;
             }
 
+            skip_to_occupied(
+                iter, reporting_level_index(iter, logarithmic->next_value_reporting_level_lowest_equivalent));
+
             if (!move_next(iter))
             {
                 return true;
@@ -12,26 +12,55 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 
+struct hdr_packed_page;
+
+/**
+ * Allocation functions used in place of malloc, calloc and free.  Each function
+ * is passed the context pointer as its first argument.  The allocator must stay
+ * valid for as long as any histogram created with it.
+ */
+typedef struct hdr_allocator
+{
+    void* (*malloc_fn)(void* context, size_t size);
+    void* (*calloc_fn)(void* context, size_t count, size_t size);
+    void (*free_fn)(void* context, void* ptr);
+    void* context;
+} hdr_allocator_t;
+
 typedef struct hdr_histogram
 {
-    int64_t lowest_trackable_value;
-    int64_t highest_trackable_value;
+    /* The fields used when recording a value are kept in the first 64 bytes. */
+    int64_t* counts;
+    int64_t total_count;
+    int64_t min_value;
+    int64_t max_value;
+    int64_t sub_bucket_mask;
     int32_t unit_magnitude;
-    int32_t significant_figures;
     int32_t sub_bucket_half_count_magnitude;
     int32_t sub_bucket_half_count;
-    int64_t sub_bucket_mask;
+    int32_t normalizing_index_offset;
+    int32_t counts_len;
+    bool running_moments;
+    bool auto_resize;
+    bool track_occupancy;
+
+    int64_t lowest_trackable_value;
+    int64_t highest_trackable_value;
+    int32_t significant_figures;
     int32_t sub_bucket_count;
     int32_t bucket_count;
-    int64_t min_value;
-    int64_t max_value;
-    int32_t normalizing_index_offset;
     double conversion_ratio;
-    int32_t counts_len;
-    int64_t total_count;
-    int64_t* counts;
+    double moments_sum;
+    double moments_sum_of_squares;
+    struct hdr_packed_page** packed_pages;
+    int32_t packed_page_magnitude;
+    int32_t packed_min_word_size;
+    bool single_allocation;
+    bool in_buffer;
+    const struct hdr_allocator* allocator;
 } hdr_histogram_t;
 
 #ifdef __cplusplus
@@ -64,6 +93,113 @@ int hdr_init(
     int significant_figures,
 	struct hdr_histogram** result);
 
+/**
+ * Allocate the memory and initialise the hdr_histogram as for hdr_init, using
+ * the supplied allocator.  The histogram keeps a pointer to the allocator and
+ * uses it for any later allocation, e.g. when it is resized, and to release its
+ * memory in hdr_close.
+ *
+ * @param lowest_trackable_value The smallest possible value to be put into the
+ * histogram.
+ * @param highest_trackable_value The largest possible value to be put into the
+ * histogram.
+ * @param significant_figures The level of precision for this histogram.
+ * @param allocator The allocation functions to use, or NULL for malloc/calloc/free.
+ * @param result Output parameter to capture allocated histogram.
+ * @return 0 on success, EINVAL if any of the parameters are invalid, ENOMEM if
+ * the allocation failed.
+ */
+int hdr_init_with_allocator(
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    const struct hdr_allocator* allocator,
+    struct hdr_histogram** result);
+
+/**
+ * Allocate the memory and initialise a packed hdr_histogram.  A packed histogram
+ * has the same bucket layout as one created with hdr_init, but its counts are
+ * stored in pages that are only allocated once a value is recorded into them.
+ * Each page keeps its counts in 1, 2, 4 or 8 byte words, widening when a count
+ * no longer fits, so a histogram holding mostly small counts in a few buckets
+ * uses a fraction of the memory of a full counts array.
+ *
+ * Recording, iteration, percentiles, hdr_add and encoding work as normal, at the
+ * cost of some extra work per recorded value.  The atomic recording functions are
+ * not supported and always return false.  Recording returns false if a page
+ * could not be allocated.
+ *
+ * @param lowest_trackable_value The smallest possible value to be put into the
+ * histogram.
+ * @param highest_trackable_value The largest possible value to be put into the
+ * histogram.
+ * @param significant_figures The level of precision for this histogram.
+ * @param result Output parameter to capture allocated histogram.
+ * @return 0 on success, EINVAL if any of the parameters are invalid, ENOMEM if
+ * the allocation failed.
+ */
+int hdr_init_packed(
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_histogram** result);
+
+/**
+ * Allocate the memory and initialise a paged hdr_histogram.  The counts are
+ * split into one page per half bucket, each allocated on the first write into
+ * it, while reads from a page that was never written return zero.  Unlike a
+ * packed histogram the counts are always full 64 bit words, so a page is never
+ * reallocated once present.
+ *
+ * This suits high precision histograms (4 or 5 significant figures) with a wide
+ * range, where most buckets are never hit: only the pages used are resident,
+ * hdr_reset only clears those pages, and the recorded and percentile iterators,
+ * percentile queries, mean and stddev skip absent pages.  The atomic recording
+ * functions are not supported and always return false.
+ *
+ * @param lowest_trackable_value The smallest possible value to be put into the
+ * histogram.
+ * @param highest_trackable_value The largest possible value to be put into the
+ * histogram.
+ * @param significant_figures The level of precision for this histogram.
+ * @param result Output parameter to capture allocated histogram.
+ * @return 0 on success, EINVAL if any of the parameters are invalid, ENOMEM if
+ * the allocation failed.
+ */
+int hdr_init_paged(
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_histogram** result);
+
+/**
+ * Allocate the memory and initialise the hdr_histogram in a single cache line
+ * aligned block, with the counts directly after the header.  Recording then only
+ * touches the first cache line of the header and the counts themselves.
+ *
+ * If use_huge_pages is set and the block is large enough, it is aligned to and
+ * advised for transparent huge pages where the platform supports it, which
+ * reduces TLB misses on large, high precision histograms.
+ *
+ * The histogram should be released with hdr_close.
+ *
+ * @param lowest_trackable_value The smallest possible value to be put into the
+ * histogram.
+ * @param highest_trackable_value The largest possible value to be put into the
+ * histogram.
+ * @param significant_figures The level of precision for this histogram.
+ * @param use_huge_pages Whether to back large histograms with huge pages.
+ * @param result Output parameter to capture allocated histogram.
+ * @return 0 on success, EINVAL if any of the parameters are invalid, ENOMEM if
+ * the allocation failed.
+ */
+int hdr_init_aligned(
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    bool use_huge_pages,
+    struct hdr_histogram** result);
+
 /**
  * Free the memory and close the hdr_histogram.
  *
@@ -123,6 +259,68 @@ bool hdr_record_value(struct hdr_histogram* h, int64_t value);
  */
 bool hdr_record_values(struct hdr_histogram* h, int64_t value, int64_t count);
 
+/**
+ * Records a batch of values in the histogram.  Equivalent to calling
+ * hdr_record_value for each of the values, but the index calculation is done
+ * a block at a time and the total count, min and max are only updated once
+ * per block.
+ *
+ * @param h "This" pointer
+ * @param values Values to add to the histogram
+ * @param length Number of entries in 'values'
+ * @return The number of values dropped because they are negative or larger than the
+ * highest_trackable_value.
+ */
+int64_t hdr_record_values_batch(struct hdr_histogram* h, const int64_t* values, size_t length);
+
+/**
+ * Records a batch of values in the histogram, each with its own count.  Equivalent to
+ * calling hdr_record_values for each of the value/count pairs.
+ *
+ * @param h "This" pointer
+ * @param values Values to add to the histogram
+ * @param counts Number of times to add each of the 'values', parallel to 'values'
+ * @param length Number of entries in 'values' and 'counts'
+ * @return The sum of the counts dropped because the value is negative or larger than the
+ * highest_trackable_value.
+ */
+int64_t hdr_record_values_batch_with_counts(
+    struct hdr_histogram* h, const int64_t* values, const int64_t* counts, size_t length);
+
+/**
+ * Records a value in the histogram, will round this value of to a precision at or better
+ * than the significant_figure specified at construction time.
+ *
+ * Will record this value atomically, however the whole structure may appear inconsistent
+ * when read concurrently with this update.  Do NOT mix calls to this method with calls
+ * to non-atomic updates.  The update is lock-free but not wait-free, the min and max
+ * are updated with compare-and-swap loops that retry under contention.
+ *
+ * @param h "This" pointer
+ * @param value Value to add to the histogram
+ * @return false if the value is larger than the highest_trackable_value and can't be recorded,
+ * true otherwise.
+ */
+bool hdr_record_value_atomic(struct hdr_histogram* h, int64_t value);
+
+/**
+ * Records count values in the histogram, will round this value of to a
+ * precision at or better than the significant_figure specified at construction
+ * time.
+ *
+ * Will record this value atomically, however the whole structure may appear inconsistent
+ * when read concurrently with this update.  Do NOT mix calls to this method with calls
+ * to non-atomic updates.  The update is lock-free but not wait-free, the min and max
+ * are updated with compare-and-swap loops that retry under contention.
+ *
+ * @param h "This" pointer
+ * @param value Value to add to the histogram
+ * @param count Number of 'value's to add to the histogram
+ * @return false if any value is larger than the highest_trackable_value and can't be recorded,
+ * true otherwise.
+ */
+bool hdr_record_values_atomic(struct hdr_histogram* h, int64_t value, int64_t count);
+
 
 /**
  * Record a value in the histogram and backfill based on an expected interval.
@@ -153,6 +351,36 @@ bool hdr_record_corrected_value(struct hdr_histogram* h, int64_t value, int64_t
  */
 bool hdr_record_corrected_values(struct hdr_histogram* h, int64_t value, int64_t count, int64_t expected_interval);
 
+/**
+ * Record a value in the histogram and backfill based on an expected interval.
+ *
+ * Atomic variant of 'hdr_record_corrected_value', the same restrictions as
+ * 'hdr_record_value_atomic' apply.
+ *
+ * @param h "This" pointer
+ * @param value Value to add to the histogram
+ * @param expected_interval The delay between recording values.
+ * @return false if the value is larger than the highest_trackable_value and can't be recorded,
+ * true otherwise.
+ */
+bool hdr_record_corrected_value_atomic(struct hdr_histogram* h, int64_t value, int64_t expected_interval);
+
+/**
+ * Record a value in the histogram 'count' times.  Applies the same correcting logic
+ * as 'hdr_record_corrected_value'.
+ *
+ * Atomic variant of 'hdr_record_corrected_values', the same restrictions as
+ * 'hdr_record_value_atomic' apply.
+ *
+ * @param h "This" pointer
+ * @param value Value to add to the histogram
+ * @param count Number of 'value's to add to the histogram
+ * @param expected_interval The delay between recording values.
+ * @return false if the value is larger than the highest_trackable_value and can't be recorded,
+ * true otherwise.
+ */
+bool hdr_record_corrected_values_atomic(struct hdr_histogram* h, int64_t value, int64_t count, int64_t expected_interval);
+
 /**
  * Adds all of the values from 'from' to 'this' histogram.  Will return the
  * number of values that are dropped when copying.  Values will be dropped
@@ -165,6 +393,19 @@ bool hdr_record_corrected_values(struct hdr_histogram* h, int64_t value, int64_t
  */
 int64_t hdr_add(struct hdr_histogram* h, const struct hdr_histogram* from);
 
+/**
+ * Subtracts all of the values in 'from' from 'this' histogram, the inverse of
+ * hdr_add.  Each value in 'from' is removed from the bucket that holds it in h.
+ * Either all of the values are subtracted or, if h does not hold every value in
+ * 'from', none are.
+ *
+ * @param h "This" pointer
+ * @param from Histogram with the values to remove.
+ * @return 0 on success, EINVAL if a value in 'from' is outside of the range of h
+ * or a count in h would become negative.
+ */
+int hdr_subtract(struct hdr_histogram* h, const struct hdr_histogram* from);
+
 /**
  * Adds all of the values from 'from' to 'this' histogram.  Will return the
  * number of values that are dropped when copying.  Values will be dropped
@@ -178,6 +419,31 @@ int64_t hdr_add(struct hdr_histogram* h, const struct hdr_histogram* from);
 int64_t hdr_add_while_correcting_for_coordinated_omission(
     struct hdr_histogram* h, struct hdr_histogram* from, int64_t expected_interval);
 
+/**
+ * Multiply all of the recorded values by 2^binary_orders_of_magnitude.  This is done
+ * by moving the normalizing index offset, so the cost is constant apart from the
+ * values in the lowest half bucket, which have to be moved individually.
+ *
+ * @param h "This" pointer
+ * @param binary_orders_of_magnitude The number of binary orders of magnitude to shift by.
+ * @return 0 on success, EINVAL if binary_orders_of_magnitude is negative, ERANGE if
+ * the largest value would no longer fit in the histogram, in which case nothing is
+ * changed.
+ */
+int hdr_shift_values_left(struct hdr_histogram* h, int32_t binary_orders_of_magnitude);
+
+/**
+ * Divide all of the recorded values by 2^binary_orders_of_magnitude.  This is done
+ * by moving the normalizing index offset, so the cost is constant.
+ *
+ * @param h "This" pointer
+ * @param binary_orders_of_magnitude The number of binary orders of magnitude to shift by.
+ * @return 0 on success, EINVAL if binary_orders_of_magnitude is negative, ERANGE if
+ * the smallest non-zero value would be shifted into the lowest half bucket and lose
+ * precision, in which case nothing is changed.
+ */
+int hdr_shift_values_right(struct hdr_histogram* h, int32_t binary_orders_of_magnitude);
+
 /**
  * Get minimum value from the histogram.  Will return 2^63-1 if the histogram
  * is empty.
@@ -202,6 +468,19 @@ int64_t hdr_max(const struct hdr_histogram* h);
  */
 int64_t hdr_value_at_percentile(const struct hdr_histogram* h, double percentile);
 
+/**
+ * Get the values at a number of percentiles with a single pass over the counts.
+ *
+ * @param h "This" pointer.
+ * @param percentiles The percentiles to get the values for, must be in ascending order.
+ * @param values Output array for the values, parallel to 'percentiles'.
+ * @param length The number of entries in 'percentiles' and 'values'.
+ * @return 0 on success, EINVAL if either array is NULL or the percentiles are not in
+ * ascending order.
+ */
+int hdr_value_at_percentiles(
+    const struct hdr_histogram* h, const double* percentiles, int64_t* values, size_t length);
+
 /**
  * Gets the standard deviation for the values in the histogram.
  *
@@ -218,6 +497,53 @@ double hdr_stddev(const struct hdr_histogram* h);
  */
 double hdr_mean(const struct hdr_histogram* h);
 
+/**
+ * Enable or disable running moments.  When enabled the histogram keeps a running
+ * sum of the recorded (median equivalent) values and of their squares, so that
+ * hdr_mean and hdr_stddev return in constant time rather than iterating over the
+ * counts.  This adds a small cost to every record.  Enabling the moments on a
+ * histogram that already contains values computes the sums from the current counts.
+ *
+ * @param h "This" pointer
+ * @param enabled Whether to maintain the running moments
+ */
+void hdr_set_running_moments(struct hdr_histogram* h, bool enabled);
+
+/**
+ * Enable or disable auto-resizing.  When enabled, recording a value larger than
+ * the histogram can currently hold grows the counts to cover it instead of
+ * dropping it, and raises highest_trackable_value to match.  Existing counts are
+ * kept in place.  This also applies to values added with hdr_add and to the
+ * histograms decoded into this one by the log reader.
+ *
+ * Only histograms allocated by hdr_init, hdr_init_packed or hdr_init_aligned can
+ * be resized, not ones that share memory owned by something else, such as the
+ * stripes of a hdr_striped_histogram.  The atomic recording functions never
+ * resize and still drop values that are out of range.
+ *
+ * @param h "This" pointer
+ * @param enabled Whether to grow the histogram on demand
+ */
+void hdr_set_auto_resize(struct hdr_histogram* h, bool enabled);
+
+/**
+ * Enable or disable occupancy tracking.  When enabled the histogram keeps a bitmap
+ * with one bit per count, so that the iterators, percentile queries and hdr_add
+ * skip runs of zero counts a word at a time.  This speeds up queries on sparse
+ * histograms, but every record also writes to the bitmap, on a different cache line
+ * to the count.  Enabling moves the counts to a larger allocation and builds the
+ * bitmap from the current counts.
+ *
+ * Only histograms allocated by hdr_init, hdr_init_aligned or hdr_init_in_buffer can
+ * track occupancy.  Packed and paged histograms skip empty pages instead.
+ *
+ * @param h "This" pointer
+ * @param enabled Whether to maintain the occupancy bitmap
+ * @return 0 on success, EINVAL if the histogram is packed or paged, ENOMEM if the
+ * counts could not be reallocated.
+ */
+int hdr_set_occupancy_tracking(struct hdr_histogram* h, bool enabled);
+
 /**
  * Determine if two values are equivalent with the histogram's resolution.
  * Where "equivalent" means that value samples recorded for any two
@@ -256,6 +582,80 @@ int64_t hdr_count_at_index(const struct hdr_histogram* h, int32_t index);
 
 int64_t hdr_value_at_index(const struct hdr_histogram* h, int32_t index);
 
+/**
+ * A cumulative count (prefix sum) index over the counts of a histogram.  Answers
+ * percentile queries with a binary search and count between queries in constant
+ * time, instead of a linear scan of the counts for every query.
+ *
+ * The index is rebuilt lazily, a query will rebuild it if the total count of the
+ * histogram has changed since it was last built.  Call hdr_cumulative_index_refresh
+ * after any other modification (e.g. a reset followed by the same number of records).
+ */
+typedef struct hdr_cumulative_index
+{
+    const struct hdr_histogram* h;
+    int32_t capacity;
+    int32_t length;
+    int64_t total_count;
+    int64_t* cumulative_counts;
+} hdr_cumulative_index_t;
+
+/**
+ * Initialise an index over the histogram.  The index is not built until first used.
+ *
+ * @param index 'This' pointer
+ * @param h The histogram to index
+ * @return 0 on success, ENOMEM if the allocation failed.
+ */
+int hdr_cumulative_index_init(struct hdr_cumulative_index* index, const struct hdr_histogram* h);
+
+/**
+ * Free the memory used by the index.
+ *
+ * @param index 'This' pointer
+ */
+void hdr_cumulative_index_destroy(struct hdr_cumulative_index* index);
+
+/**
+ * Rebuild the index from the current counts of the histogram.
+ *
+ * @param index 'This' pointer
+ * @return 0 on success, ENOMEM if the index needed to grow and the allocation failed.
+ */
+int hdr_cumulative_index_refresh(struct hdr_cumulative_index* index);
+
+/**
+ * Get the value at a specific percentile, equivalent to hdr_value_at_percentile.
+ *
+ * @param index 'This' pointer
+ * @param percentile The percentile to get the value for
+ */
+int64_t hdr_cumulative_index_value_at_percentile(struct hdr_cumulative_index* index, double percentile);
+
+/**
+ * Get the values at a number of percentiles.
+ *
+ * @param index 'This' pointer
+ * @param percentiles The percentiles to get the values for
+ * @param values Output array for the values, parallel to 'percentiles'
+ * @param length The number of entries in 'percentiles' and 'values'
+ * @return 0 on success, EINVAL if either array is NULL, ENOMEM if the index could not be built.
+ */
+int hdr_cumulative_index_values_at_percentiles(
+    struct hdr_cumulative_index* index, const double* percentiles, int64_t* values, size_t length);
+
+/**
+ * Get the count of recorded values between low and high (inclusive), to within
+ * the histogram resolution.
+ *
+ * @param index 'This' pointer
+ * @param low The lower bound of the range
+ * @param high The upper bound of the range
+ * @return The count of values {@literal >=} lowestEquivalentValue(low) and
+ * {@literal <=} highestEquivalentValue(high)
+ */
+int64_t hdr_cumulative_index_count_between(struct hdr_cumulative_index* index, int64_t low, int64_t high);
+
 struct hdr_iter_percentiles
 {
     bool seen_last_value;
@@ -391,7 +791,8 @@ int hdr_percentiles_print(
     double value_scale, format_type format);
 
 /**
-* Internal allocation methods, used by hdr_dbl_histogram.
+* Allocation methods for histograms in caller managed memory, also used
+* internally by hdr_dbl_histogram and hdr_striped_histogram.
 */
 typedef struct hdr_histogram_bucket_config
 {
@@ -415,6 +816,40 @@ int hdr_calculate_bucket_config(
 
 void hdr_init_preallocated(struct hdr_histogram* h, hdr_histogram_bucket_config_t* cfg);
 
+/**
+ * The number of bytes needed to hold a histogram, header and counts, with the
+ * layout described by cfg, see hdr_init_in_buffer.
+ *
+ * @param cfg The bucket configuration from hdr_calculate_bucket_config.
+ * @return The size of the buffer required.
+ */
+size_t hdr_buffer_size(const hdr_histogram_bucket_config_t* cfg);
+
+/**
+ * Initialise a histogram inside a caller provided buffer of at least
+ * hdr_buffer_size(cfg) bytes, aligned to at least 8 bytes.  No memory is
+ * allocated, the buffer is zeroed and the counts follow the header within it.
+ * The buffer is owned by the caller and must outlive the histogram, hdr_close
+ * does not release it.
+ *
+ * An in-buffer histogram can be auto-resized, in which case the counts move out
+ * of the buffer to memory from the allocator, which hdr_close then frees.
+ *
+ * @param buffer The memory to initialise the histogram in.
+ * @param buffer_len The size of the buffer in bytes.
+ * @param cfg The bucket configuration from hdr_calculate_bucket_config.
+ * @param allocator The allocator for any later allocations, or NULL for libc.
+ * @param result Output parameter to capture the histogram, which points into
+ * buffer.
+ * @return 0 on success, EINVAL if the buffer is too small or not aligned.
+ */
+int hdr_init_in_buffer(
+    void* buffer,
+    size_t buffer_len,
+    hdr_histogram_bucket_config_t* cfg,
+    const struct hdr_allocator* allocator,
+    struct hdr_histogram** result);
+
 int64_t hdr_size_of_equivalent_value_range(const struct hdr_histogram* h, int64_t value);
 
 int64_t hdr_next_non_equivalent_value(const struct hdr_histogram* h, int64_t value);
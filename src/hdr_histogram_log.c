@@ -23,6 +23,7 @@
 #include "hdr_histogram.h"
 #include "hdr_histogram_log.h"
 #include "hdr_tests.h"
+#include "hdr_internal.h"
 
 #if defined(_MSC_VER)
 #include <intsafe.h>
@@ -46,30 +47,6 @@ int32_t counts_index_for(const struct hdr_histogram* h, int64_t value);
     }                       \
     while (0)
 
-static int realloc_buffer(
-    void** buffer, size_t nmemb, ssize_t size)
-{
-    size_t len = nmemb * size;
-    if (NULL == *buffer)
-    {
-        *buffer = malloc(len);
-    }
-    else
-    {
-        *buffer = realloc(*buffer, len);
-    }
-
-    if (NULL == *buffer)
-    {
-        return ENOMEM;
-    }
-    else
-    {
-        memset(*buffer, 0, len);
-        return 0;
-    }
-}
-
 /*  ######  ######## ########  #### ##    ##  ######    ######  */
 /* ##    ##    ##    ##     ##  ##  ###   ## ##    ##  ##    ## */
 /* ##          ##    ##     ##  ##  ####  ## ##        ##       */
@@ -152,6 +129,16 @@ const char* hdr_strerror(int errnum)
     }
 }
 
+static voidpf strm_alloc(voidpf opaque, uInt items, uInt size)
+{
+    return hdr_allocator_malloc((const struct hdr_allocator*) opaque, (size_t) items * size);
+}
+
+static void strm_free(voidpf opaque, voidpf address)
+{
+    hdr_allocator_free((const struct hdr_allocator*) opaque, address);
+}
+
 static void strm_init(z_stream* strm)
 {
     strm->zfree = NULL;
@@ -161,6 +148,17 @@ static void strm_init(z_stream* strm)
     strm->avail_in = 0;
 }
 
+static void strm_init_with_allocator(z_stream* strm, const struct hdr_allocator* allocator)
+{
+    strm_init(strm);
+    if (allocator)
+    {
+        strm->zalloc = strm_alloc;
+        strm->zfree = strm_free;
+        strm->opaque = (voidpf) allocator;
+    }
+}
+
 union uint64_dbl_cvt
 {
     uint64_t l;
@@ -232,11 +230,14 @@ int hdr_encode_compressed(
     uLong encoded_size;
     uLongf dest_len;
     size_t compressed_size;
+    size_t encoded_len;
+    int32_t lowest, highest, counts_limit;
 
-    int32_t len_to_max = counts_index_for(h, h->max_value) + 1;
-    int32_t counts_limit = len_to_max < h->counts_len ? len_to_max : h->counts_len;
+    hdr_counts_touched_range(h, &lowest, &highest);
+    counts_limit = highest + 1;
+    lowest = lowest < counts_limit ? lowest : counts_limit;
 
-    const size_t encoded_len = SIZEOF_ENCODING_FLYWEIGHT_V1 + MAX_BYTES_LEB128 * (size_t) counts_limit;
+    encoded_len = SIZEOF_ENCODING_FLYWEIGHT_V1 + MAX_BYTES_LEB128 * (size_t) counts_limit;
     if ((encoded = (_encoding_flyweight_v1*) calloc(encoded_len, sizeof(uint8_t))) == NULL)
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
@@ -244,14 +245,21 @@ int hdr_encode_compressed(
 
     for (i = 0; i < counts_limit;)
     {
-        int64_t value = h->counts[i];
+        int64_t value = hdr_count_at_index(h, i);
         i++;
 
         if (value == 0)
         {
             int32_t zeros = 1;
 
-            while (i < counts_limit && 0 == h->counts[i])
+            /* Nothing below the min is recorded, other than at index 0. */
+            if (i < lowest)
+            {
+                zeros += lowest - i;
+                i = lowest;
+            }
+
+            while (i < counts_limit && 0 == hdr_count_at_index(h, i))
             {
                 zeros++;
                 i++;
@@ -410,6 +418,7 @@ static int _apply_to_counts(
 static int hdr_decode_compressed_v0(
     _compression_flyweight* compression_flyweight,
     size_t length,
+    const struct hdr_allocator* allocator,
     struct hdr_histogram** histogram)
 {
     struct hdr_histogram* h = NULL;
@@ -420,7 +429,7 @@ static int hdr_decode_compressed_v0(
     int32_t compressed_len, encoding_cookie, word_size, significant_figures, counts_array_len;
     int64_t lowest_trackable_value, highest_trackable_value;
 
-    strm_init(&strm);
+    strm_init_with_allocator(&strm, allocator);
     if (inflateInit(&strm) != Z_OK)
     {
         FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
@@ -454,17 +463,18 @@ static int hdr_decode_compressed_v0(
     highest_trackable_value = be64toh(encoding_flyweight.highest_trackable_value);
     significant_figures = be32toh(encoding_flyweight.significant_figures);
 
-    if (hdr_init(
+    if (hdr_init_with_allocator(
         lowest_trackable_value,
         highest_trackable_value,
         significant_figures,
+        allocator,
         &h) != 0)
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
     }
 
     counts_array_len = h->counts_len * word_size;
-    if ((counts_array = calloc(1, (size_t) counts_array_len)) == NULL)
+    if ((counts_array = hdr_allocator_calloc(allocator, 1, (size_t) counts_array_len)) == NULL)
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
     }
@@ -485,11 +495,14 @@ static int hdr_decode_compressed_v0(
 
 cleanup:
     (void)inflateEnd(&strm);
-    free(counts_array);
+    hdr_allocator_free(allocator, counts_array);
 
     if (result != 0)
     {
-        free(h);
+        if (h)
+        {
+            hdr_close(h);
+        }
     }
     else if (NULL == *histogram)
     {
@@ -498,7 +511,7 @@ cleanup:
     else
     {
         hdr_add(*histogram, h);
-        free(h);
+        hdr_close(h);
     }
 
     return result;
@@ -507,6 +520,7 @@ cleanup:
 static int hdr_decode_compressed_v1(
     _compression_flyweight* compression_flyweight,
     size_t length,
+    const struct hdr_allocator* allocator,
     struct hdr_histogram** histogram)
 {
     struct hdr_histogram* h = NULL;
@@ -517,7 +531,7 @@ static int hdr_decode_compressed_v1(
     int32_t compressed_length, word_size, significant_figures, counts_limit, encoding_cookie, counts_array_len;
     int64_t lowest_trackable_value, highest_trackable_value;
 
-    strm_init(&strm);
+    strm_init_with_allocator(&strm, allocator);
     if (inflateInit(&strm) != Z_OK)
     {
         FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
@@ -552,10 +566,11 @@ static int hdr_decode_compressed_v1(
     highest_trackable_value = be64toh(encoding_flyweight.highest_trackable_value);
     significant_figures = be32toh(encoding_flyweight.significant_figures);
 
-    if (hdr_init(
+    if (hdr_init_with_allocator(
         lowest_trackable_value,
         highest_trackable_value,
         significant_figures,
+        allocator,
         &h) != 0)
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
@@ -564,7 +579,7 @@ static int hdr_decode_compressed_v1(
     /* Give the temp uncompressed array a little bif of extra */
     counts_array_len = counts_limit * word_size;
 
-    if ((counts_array = calloc(1, (size_t) counts_array_len)) == NULL)
+    if ((counts_array = hdr_allocator_calloc(allocator, 1, (size_t) counts_array_len)) == NULL)
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
     }
@@ -579,17 +594,20 @@ static int hdr_decode_compressed_v1(
 
     _apply_to_counts(h, word_size, counts_array, counts_limit);
 
-    h->normalizing_index_offset = be32toh(encoding_flyweight.normalizing_index_offset);
+    /* The counts are encoded in value order, so they are already normalised. */
     h->conversion_ratio = int64_bits_to_double(be64toh(encoding_flyweight.conversion_ratio_bits));
     hdr_reset_internal_counters(h);
 
 cleanup:
     (void)inflateEnd(&strm);
-    free(counts_array);
+    hdr_allocator_free(allocator, counts_array);
 
     if (result != 0)
     {
-        free(h);
+        if (h)
+        {
+            hdr_close(h);
+        }
     }
     else if (NULL == *histogram)
     {
@@ -598,7 +616,7 @@ cleanup:
     else
     {
         hdr_add(*histogram, h);
-        free(h);
+        hdr_close(h);
     }
 
     return result;
@@ -607,6 +625,7 @@ cleanup:
 static int hdr_decode_compressed_v2(
     _compression_flyweight* compression_flyweight,
     size_t length,
+    const struct hdr_allocator* allocator,
     struct hdr_histogram** histogram)
 {
     struct hdr_histogram* h = NULL;
@@ -618,7 +637,7 @@ static int hdr_decode_compressed_v2(
     int32_t compressed_length, encoding_cookie, counts_limit, significant_figures;
     int64_t lowest_trackable_value, highest_trackable_value;
 
-    strm_init(&strm);
+    strm_init_with_allocator(&strm, allocator);
     if (inflateInit(&strm) != Z_OK)
     {
         FAIL_AND_CLEANUP(cleanup, result, HDR_INFLATE_FAIL);
@@ -652,7 +671,7 @@ static int hdr_decode_compressed_v2(
     highest_trackable_value = be64toh(encoding_flyweight.highest_trackable_value);
     significant_figures = be32toh(encoding_flyweight.significant_figures);
 
-    rc = hdr_init(lowest_trackable_value, highest_trackable_value, significant_figures, &h);
+    rc = hdr_init_with_allocator(lowest_trackable_value, highest_trackable_value, significant_figures, allocator, &h);
     if (rc)
     {
         FAIL_AND_CLEANUP(cleanup, result, rc);
@@ -661,7 +680,7 @@ static int hdr_decode_compressed_v2(
     /* Make sure there at least 9 bytes to read */
     /* if there is a corrupt value at the end */
     /* of the array we won't read corrupt data or crash. */
-    if ((counts_array = calloc(1, (size_t) counts_limit + 9)) == NULL)
+    if ((counts_array = hdr_allocator_calloc(allocator, 1, (size_t) counts_limit + 9)) == NULL)
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
     }
@@ -680,17 +699,20 @@ static int hdr_decode_compressed_v2(
         FAIL_AND_CLEANUP(cleanup, result, rc);
     }
 
-    h->normalizing_index_offset = be32toh(encoding_flyweight.normalizing_index_offset);
+    /* The counts are encoded in value order, so they are already normalised. */
     h->conversion_ratio = int64_bits_to_double(be64toh(encoding_flyweight.conversion_ratio_bits));
     hdr_reset_internal_counters(h);
 
 cleanup:
     (void)inflateEnd(&strm);
-    free(counts_array);
+    hdr_allocator_free(allocator, counts_array);
 
     if (result != 0)
     {
-        free(h);
+        if (h)
+        {
+            hdr_close(h);
+        }
     }
     else if (NULL == *histogram)
     {
@@ -699,7 +721,7 @@ cleanup:
     else
     {
         hdr_add(*histogram, h);
-        free(h);
+        hdr_close(h);
     }
 
     return result;
@@ -707,6 +729,12 @@ cleanup:
 
 int hdr_decode_compressed(
     uint8_t* buffer, size_t length, struct hdr_histogram** histogram)
+{
+    return hdr_decode_compressed_with_allocator(buffer, length, histogram, NULL);
+}
+
+int hdr_decode_compressed_with_allocator(
+    uint8_t* buffer, size_t length, struct hdr_histogram** histogram, const struct hdr_allocator* allocator)
 {
     int32_t compression_cookie;
     _compression_flyweight* compression_flyweight;
@@ -721,15 +749,15 @@ int hdr_decode_compressed(
     compression_cookie = get_cookie_base(be32toh(compression_flyweight->cookie));
     if (V0_COMPRESSION_COOKIE == compression_cookie)
     {
-        return hdr_decode_compressed_v0(compression_flyweight, length, histogram);
+        return hdr_decode_compressed_v0(compression_flyweight, length, allocator, histogram);
     }
     else if (V1_COMPRESSION_COOKIE == compression_cookie)
     {
-        return hdr_decode_compressed_v1(compression_flyweight, length, histogram);
+        return hdr_decode_compressed_v1(compression_flyweight, length, allocator, histogram);
     }
     else if (V2_COMPRESSION_COOKIE == compression_cookie)
     {
-        return hdr_decode_compressed_v2(compression_flyweight, length, histogram);
+        return hdr_decode_compressed_v2(compression_flyweight, length, allocator, histogram);
     }
 
     return HDR_COMPRESSION_COOKIE_MISMATCH;
@@ -1056,6 +1084,13 @@ static ssize_t hdr_getline(char** lineptr, FILE* stream)
 int hdr_log_read(
     hdr_log_reader_t* reader, FILE* file, struct hdr_histogram** histogram,
     hdr_timespec_t* timestamp, hdr_timespec_t* interval)
+{
+    return hdr_log_read_with_allocator(reader, file, histogram, timestamp, interval, NULL);
+}
+
+int hdr_log_read_with_allocator(
+    hdr_log_reader_t* reader, FILE* file, struct hdr_histogram** histogram,
+    hdr_timespec_t* timestamp, hdr_timespec_t* interval, const struct hdr_allocator* allocator)
 {
     const char* format_v12 = "%lf,%lf,%d.%d,%s";
     const char* format_v13 = "Tag=%*[^,],%lf,%lf,%d.%d,%s";
@@ -1094,14 +1129,14 @@ int hdr_log_read(
         FAIL_AND_CLEANUP(cleanup, result, EOF);
     }
 
-    r = realloc_buffer((void**)&base64_histogram, sizeof(char), read);
-    if (r != 0)
+    base64_histogram = hdr_allocator_calloc(allocator, (size_t) read, sizeof(char));
+    if (NULL == base64_histogram)
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
     }
 
-    r = realloc_buffer((void**)&compressed_histogram, sizeof(uint8_t), read);
-    if (r != 0)
+    compressed_histogram = hdr_allocator_calloc(allocator, (size_t) read, sizeof(uint8_t));
+    if (NULL == compressed_histogram)
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
     }
@@ -1133,7 +1168,7 @@ int hdr_log_read(
         FAIL_AND_CLEANUP(cleanup, result, r);
     }
 
-    r = hdr_decode_compressed(compressed_histogram, compressed_len, histogram);
+    r = hdr_decode_compressed_with_allocator(compressed_histogram, compressed_len, histogram, allocator);
     if (r != 0)
     {
         FAIL_AND_CLEANUP(cleanup, result, r);
@@ -1144,8 +1179,8 @@ int hdr_log_read(
 
 cleanup:
     free(line);
-    free(base64_histogram);
-    free(compressed_histogram);
+    hdr_allocator_free(allocator, base64_histogram);
+    hdr_allocator_free(allocator, compressed_histogram);
 
     return result;
 }
@@ -1184,14 +1219,24 @@ cleanup:
 }
 
 int hdr_log_decode(struct hdr_histogram** histogram, char* base64_histogram, size_t base64_len)
+{
+    return hdr_log_decode_with_allocator(histogram, base64_histogram, base64_len, NULL);
+}
+
+int hdr_log_decode_with_allocator(
+    struct hdr_histogram** histogram, char* base64_histogram, size_t base64_len,
+    const struct hdr_allocator* allocator)
 {
     int r;
     uint8_t* compressed_histogram = NULL;
     int result = 0;
 
     size_t compressed_len = hdr_base64_decoded_len(base64_len);
-    compressed_histogram = malloc(sizeof(uint8_t)*compressed_len);
-    memset(compressed_histogram, 0, compressed_len);
+    compressed_histogram = hdr_allocator_calloc(allocator, compressed_len, sizeof(uint8_t));
+    if (NULL == compressed_histogram)
+    {
+        return ENOMEM;
+    }
 
     r = hdr_base64_decode(
         base64_histogram, base64_len, compressed_histogram, compressed_len);
@@ -1201,14 +1246,14 @@ int hdr_log_decode(struct hdr_histogram** histogram, char* base64_histogram, siz
         FAIL_AND_CLEANUP(cleanup, result, r);
     }
 
-    r = hdr_decode_compressed(compressed_histogram, compressed_len, histogram);
+    r = hdr_decode_compressed_with_allocator(compressed_histogram, compressed_len, histogram, allocator);
     if (r != 0)
     {
         FAIL_AND_CLEANUP(cleanup, result, r);
     }
 
 cleanup:
-    free(compressed_histogram);
+    hdr_allocator_free(allocator, compressed_histogram);
 
     return result;
 }
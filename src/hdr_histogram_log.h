@@ -42,6 +42,22 @@ int hdr_log_encode(struct hdr_histogram* histogram, char** encoded_histogram);
  */
 int hdr_log_decode(struct hdr_histogram** histogram, char* base64_histogram, size_t base64_len);
 
+/**
+ * Decode and decompress the histogram as for hdr_log_decode, allocating the
+ * histogram and all temporary buffers, including zlib's state, from the
+ * supplied allocator.
+ *
+ * @param histogram the histogram to decode into, or a pointer to NULL to allocate one
+ * @param base64_histogram the base64 encoded histogram
+ * @param base64_len the length of the base64 string
+ * @param allocator the allocation functions to use, or NULL for libc
+ * @return 0 on success, ENOMEM if an allocation failed or a decoding error (see
+ * hdr_strerror).
+ */
+int hdr_log_decode_with_allocator(
+    struct hdr_histogram** histogram, char* base64_histogram, size_t base64_len,
+    const struct hdr_allocator* allocator);
+
 typedef struct hdr_log_writer
 {
     uint32_t nonce;
@@ -151,6 +167,23 @@ int hdr_log_read(
     hdr_log_reader_t* reader, FILE* file, struct hdr_histogram** histogram,
     hdr_timespec_t* timestamp, hdr_timespec_t* interval);
 
+/**
+ * Reads an entry from the log as for hdr_log_read, allocating the histogram and
+ * the decoding buffers from the supplied allocator.  The line itself is still
+ * read with getline.
+ *
+ * @param reader 'This' pointer
+ * @param file The stream to read from
+ * @param histogram Pointer to allocate a histogram to or to merge into.
+ * @param timestamp The first timestamp from the CSV entry.
+ * @param interval The second timestamp from the CSV entry
+ * @param allocator The allocation functions to use, or NULL for libc
+ * @return As for hdr_log_read.
+ */
+int hdr_log_read_with_allocator(
+    hdr_log_reader_t* reader, FILE* file, struct hdr_histogram** histogram,
+    hdr_timespec_t* timestamp, hdr_timespec_t* interval, const struct hdr_allocator* allocator);
+
 /**
  * Returns a string representation of the error number.
  *
@@ -0,0 +1,37 @@
+/**
+ * hdr_internal.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef HDR_INTERNAL_H
+#define HDR_INTERNAL_H
+
+/* Functions shared between the library's source files, not installed or part of the API. */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "hdr_histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Structures written by different threads are kept on separate cache lines of this size. */
+#define HDR_CACHE_LINE_SIZE 64
+
+void hdr_counts_touched_range(const struct hdr_histogram* h, int32_t* lowest, int32_t* highest);
+
+size_t hdr_round_up_to(size_t size, size_t alignment);
+uint8_t* hdr_align_to_cache_line(void* ptr);
+
+void* hdr_allocator_malloc(const struct hdr_allocator* allocator, size_t size);
+void* hdr_allocator_calloc(const struct hdr_allocator* allocator, size_t count, size_t size);
+void hdr_allocator_free(const struct hdr_allocator* allocator, void* ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -18,12 +18,24 @@ int hdr_interval_recorder_init_all(
     int64_t lowest_trackable_value,
     int64_t highest_trackable_value,
     int significant_figures)
+{
+    return hdr_interval_recorder_init_all_with_allocator(
+        r, lowest_trackable_value, highest_trackable_value, significant_figures, NULL);
+}
+
+int hdr_interval_recorder_init_all_with_allocator(
+    struct hdr_interval_recorder* r,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    const struct hdr_allocator* allocator)
 {
     int result;
     r->active = r->inactive = NULL;
     result = hdr_writer_reader_phaser_init(&r->phaser);
     result = result == 0
-        ? hdr_init(lowest_trackable_value, highest_trackable_value, significant_figures, &r->active)
+        ? hdr_init_with_allocator(
+            lowest_trackable_value, highest_trackable_value, significant_figures, allocator, &r->active)
         : result;
 
     return result;
@@ -51,7 +63,7 @@ struct hdr_histogram* hdr_interval_recorder_sample_and_recycle(
         int64_t lo = r->active->lowest_trackable_value;
         int64_t hi = r->active->highest_trackable_value;
         int significant_figures = r->active->significant_figures;
-        hdr_init(lo, hi, significant_figures, &inactive_histogram);
+        hdr_init_with_allocator(lo, hi, significant_figures, r->active->allocator, &inactive_histogram);
     }
 
     hdr_phaser_reader_lock(&r->phaser);
@@ -177,3 +189,91 @@ int64_t hdr_interval_recorder_record_corrected_values(
     return params[3];
 
 }
+
+static void update_value_atomic(struct hdr_histogram* data, void* arg)
+{
+    struct hdr_histogram* h = data;
+    int64_t* params = arg;
+    params[1] = hdr_record_value_atomic(h, params[0]);
+}
+
+int64_t hdr_interval_recorder_record_value_atomic(
+    struct hdr_interval_recorder* r,
+    int64_t value
+)
+{
+    int64_t params[2];
+    params[0] = value;
+    params[1] = 0;
+
+    hdr_interval_recorder_update(r, update_value_atomic, &params[0]);
+    return params[1];
+}
+
+static void update_values_atomic(struct hdr_histogram* data, void* arg)
+{
+    struct hdr_histogram* h = data;
+    int64_t* params = arg;
+    params[2] = hdr_record_values_atomic(h, params[0], params[1]);
+}
+
+int64_t hdr_interval_recorder_record_values_atomic(
+    struct hdr_interval_recorder* r,
+    int64_t value,
+    int64_t count
+)
+{
+    int64_t params[3];
+    params[0] = value;
+    params[1] = count;
+    params[2] = 0;
+
+    hdr_interval_recorder_update(r, update_values_atomic, &params[0]);
+    return params[2];
+}
+
+static void update_corrected_value_atomic(struct hdr_histogram* data, void* arg)
+{
+    struct hdr_histogram* h = data;
+    int64_t* params = arg;
+    params[2] = hdr_record_corrected_value_atomic(h, params[0], params[1]);
+}
+
+int64_t hdr_interval_recorder_record_corrected_value_atomic(
+    struct hdr_interval_recorder* r,
+    int64_t value,
+    int64_t expected_interval
+)
+{
+    int64_t params[3];
+    params[0] = value;
+    params[1] = expected_interval;
+    params[2] = 0;
+
+    hdr_interval_recorder_update(r, update_corrected_value_atomic, &params[0]);
+    return params[2];
+}
+
+static void update_corrected_values_atomic(struct hdr_histogram* data, void* arg)
+{
+    struct hdr_histogram* h = data;
+    int64_t* params = arg;
+    params[3] = hdr_record_corrected_values_atomic(h, params[0], params[1], params[2]);
+}
+
+int64_t hdr_interval_recorder_record_corrected_values_atomic(
+    struct hdr_interval_recorder* r,
+    int64_t value,
+    int64_t count,
+    int64_t expected_interval
+)
+{
+    int64_t params[4];
+    params[0] = value;
+    params[1] = count;
+    params[2] = expected_interval;
+    params[3] = 0;
+
+    hdr_interval_recorder_update(r, update_corrected_values_atomic, &params[0]);
+    return params[3];
+}
@@ -31,6 +31,18 @@ int hdr_interval_recorder_init_all(
     int64_t highest_trackable_value,
     int significant_figures);
 
+/*
+ * As hdr_interval_recorder_init_all, but the histograms are allocated with the
+ * given allocator.  Histograms created by hdr_interval_recorder_sample_and_recycle
+ * use the allocator of the active histogram.
+ */
+int hdr_interval_recorder_init_all_with_allocator(
+    struct hdr_interval_recorder* r,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    const struct hdr_allocator* allocator);
+
 void hdr_interval_recorder_destroy(struct hdr_interval_recorder* r);
 
 int64_t hdr_interval_recorder_record_value(
@@ -57,6 +69,38 @@ int64_t hdr_interval_recorder_record_corrected_values(
     int64_t expected_interval
 );
 
+/*
+ * The non-atomic record functions above assume a single writer thread.  The
+ * _atomic variants below use the atomic histogram updates and may be called
+ * from any number of writer threads concurrently.  Do not mix the two for a
+ * single recorder.  They are lock-free but not wait-free: the min and max are
+ * updated in compare-and-swap loops that retry while other writers race them.
+ */
+
+int64_t hdr_interval_recorder_record_value_atomic(
+    struct hdr_interval_recorder* r,
+    int64_t value
+);
+
+int64_t hdr_interval_recorder_record_values_atomic(
+    struct hdr_interval_recorder* r,
+    int64_t value,
+    int64_t count
+);
+
+int64_t hdr_interval_recorder_record_corrected_value_atomic(
+    struct hdr_interval_recorder* r,
+    int64_t value,
+    int64_t expected_interval
+);
+
+int64_t hdr_interval_recorder_record_corrected_values_atomic(
+    struct hdr_interval_recorder* r,
+    int64_t value,
+    int64_t count,
+    int64_t expected_interval
+);
+
 struct hdr_histogram* hdr_interval_recorder_sample_and_recycle(
 	struct hdr_interval_recorder* r,
 	struct hdr_histogram* inactive_histogram);
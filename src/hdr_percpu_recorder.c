@@ -0,0 +1,197 @@
+/**
+ * hdr_percpu_recorder.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#include "hdr_histogram.h"
+#include "hdr_interval_recorder.h"
+#include "hdr_percpu_recorder.h"
+#include "hdr_internal.h"
+
+static int32_t configured_cpus(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int32_t) info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_CONF)
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    return cpus > 0 ? (int32_t) cpus : 1;
+#else
+    return 1;
+#endif
+}
+
+static uint32_t current_cpu(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    return (uint32_t) GetCurrentProcessorNumber();
+#elif defined(__linux__)
+    int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : (uint32_t) cpu;
+#else
+    return 0;
+#endif
+}
+
+static struct hdr_percpu_slot* slot_at(struct hdr_percpu_recorder* pr, int32_t i)
+{
+    return (struct hdr_percpu_slot*) (pr->slots + pr->slot_stride * (size_t) i);
+}
+
+static struct hdr_percpu_slot* current_slot(struct hdr_percpu_recorder* pr)
+{
+    return slot_at(pr, (int32_t) (current_cpu() % (uint32_t) pr->slot_count));
+}
+
+int hdr_percpu_recorder_init(
+    struct hdr_percpu_recorder* pr,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    int32_t slot_count)
+{
+    struct hdr_histogram_bucket_config cfg;
+    int32_t i;
+    int r;
+
+    r = hdr_calculate_bucket_config(lowest_trackable_value, highest_trackable_value, significant_figures, &cfg);
+    if (r)
+    {
+        return r;
+    }
+
+    if (slot_count < 0)
+    {
+        return EINVAL;
+    }
+
+    pr->slot_count = slot_count > 0 ? slot_count : configured_cpus();
+    pr->slot_stride = hdr_round_up_to(sizeof(struct hdr_percpu_slot), HDR_CACHE_LINE_SIZE);
+    pr->inactive = NULL;
+
+    /* Over allocated by a cache line so the slots can be aligned. */
+    pr->allocation = calloc(1, pr->slot_stride * (size_t) pr->slot_count + HDR_CACHE_LINE_SIZE);
+    if (!pr->allocation)
+    {
+        return ENOMEM;
+    }
+
+    pr->slots = hdr_align_to_cache_line(pr->allocation);
+
+    for (i = 0; i < pr->slot_count; i++)
+    {
+        struct hdr_percpu_slot* slot = slot_at(pr, i);
+
+        r = hdr_interval_recorder_init_all(
+            &slot->recorder, lowest_trackable_value, highest_trackable_value, significant_figures);
+        if (0 == r)
+        {
+            r = hdr_init(lowest_trackable_value, highest_trackable_value, significant_figures, &slot->spare);
+        }
+
+        if (r)
+        {
+            pr->slot_count = i + 1;
+            hdr_percpu_recorder_destroy(pr);
+            return r;
+        }
+    }
+
+    return 0;
+}
+
+void hdr_percpu_recorder_destroy(struct hdr_percpu_recorder* pr)
+{
+    int32_t i;
+
+    for (i = 0; i < pr->slot_count; i++)
+    {
+        struct hdr_percpu_slot* slot = slot_at(pr, i);
+
+        hdr_interval_recorder_destroy(&slot->recorder);
+        if (slot->spare)
+        {
+            hdr_close(slot->spare);
+        }
+    }
+
+    if (pr->inactive)
+    {
+        hdr_close(pr->inactive);
+    }
+
+    free(pr->allocation);
+    pr->allocation = NULL;
+    pr->slot_count = 0;
+}
+
+bool hdr_percpu_recorder_record_value(struct hdr_percpu_recorder* pr, int64_t value)
+{
+    return 0 != hdr_interval_recorder_record_value_atomic(&current_slot(pr)->recorder, value);
+}
+
+bool hdr_percpu_recorder_record_values(struct hdr_percpu_recorder* pr, int64_t value, int64_t count)
+{
+    return 0 != hdr_interval_recorder_record_values_atomic(&current_slot(pr)->recorder, value, count);
+}
+
+bool hdr_percpu_recorder_record_corrected_value(
+    struct hdr_percpu_recorder* pr, int64_t value, int64_t expected_interval)
+{
+    return 0 != hdr_interval_recorder_record_corrected_value_atomic(
+        &current_slot(pr)->recorder, value, expected_interval);
+}
+
+struct hdr_histogram* hdr_percpu_recorder_sample_and_recycle(
+    struct hdr_percpu_recorder* pr, struct hdr_histogram* histogram)
+{
+    int32_t i;
+
+    if (NULL == histogram)
+    {
+        const struct hdr_histogram* active = slot_at(pr, 0)->recorder.active;
+        if (hdr_init(
+            active->lowest_trackable_value, active->highest_trackable_value, active->significant_figures, &histogram))
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        hdr_reset(histogram);
+    }
+
+    for (i = 0; i < pr->slot_count; i++)
+    {
+        struct hdr_percpu_slot* slot = slot_at(pr, i);
+
+        /* The previous sample from this slot becomes its next active histogram. */
+        hdr_reset(slot->spare);
+        slot->spare = hdr_interval_recorder_sample_and_recycle(&slot->recorder, slot->spare);
+        hdr_add(histogram, slot->spare);
+    }
+
+    return histogram;
+}
+
+struct hdr_histogram* hdr_percpu_recorder_sample(struct hdr_percpu_recorder* pr)
+{
+    pr->inactive = hdr_percpu_recorder_sample_and_recycle(pr, pr->inactive);
+    return pr->inactive;
+}
@@ -0,0 +1,126 @@
+/**
+ * hdr_percpu_recorder.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * An interval recorder split into one slot per CPU, each with its own
+ * active/inactive histogram pair and phaser on separate cache lines.  Writers
+ * record into the slot for the CPU they are running on, so threads on
+ * different CPUs never contend on the phaser epoch or the counts.  Sampling
+ * flips every slot and merges them into a single histogram.
+ */
+
+#ifndef HDR_PERCPU_RECORDER_H
+#define HDR_PERCPU_RECORDER_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hdr_histogram.h"
+#include "hdr_interval_recorder.h"
+
+typedef struct hdr_percpu_slot
+{
+    struct hdr_interval_recorder recorder;
+    struct hdr_histogram* spare;
+} hdr_percpu_slot_t;
+
+typedef struct hdr_percpu_recorder
+{
+    void* allocation;
+    uint8_t* slots;
+    size_t slot_stride;
+    int32_t slot_count;
+    struct hdr_histogram* inactive;
+} hdr_percpu_recorder_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialise the recorder, allocating the histograms for every slot.
+ *
+ * @param pr The recorder to initialise.
+ * @param lowest_trackable_value The smallest possible value to be put into the
+ * histogram.
+ * @param highest_trackable_value The largest possible value to be put into the
+ * histogram.
+ * @param significant_figures The level of precision for this histogram.
+ * @param slot_count The number of slots, or 0 for one per configured CPU.  CPUs
+ * beyond the slot count share slots.
+ * @return 0 on success, EINVAL if any of the parameters are invalid, ENOMEM if
+ * an allocation failed.
+ */
+int hdr_percpu_recorder_init(
+    struct hdr_percpu_recorder* pr,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    int32_t slot_count);
+
+/**
+ * Free all of the slots and histograms owned by the recorder.
+ *
+ * @param pr The recorder to destroy.
+ */
+void hdr_percpu_recorder_destroy(struct hdr_percpu_recorder* pr);
+
+/**
+ * Record a value into the slot of the current CPU.  May be called from any
+ * number of threads concurrently.
+ *
+ * @param pr "This" pointer
+ * @param value Value to record.
+ * @return false if the value is out of range, true otherwise.
+ */
+bool hdr_percpu_recorder_record_value(struct hdr_percpu_recorder* pr, int64_t value);
+
+/**
+ * Record count values into the slot of the current CPU.
+ *
+ * @param pr "This" pointer
+ * @param value Value to record.
+ * @param count Number of 'value's to record.
+ * @return false if the value is out of range, true otherwise.
+ */
+bool hdr_percpu_recorder_record_values(struct hdr_percpu_recorder* pr, int64_t value, int64_t count);
+
+/**
+ * Record a value into the slot of the current CPU, backfilling based on an
+ * expected interval as hdr_record_corrected_value.
+ *
+ * @param pr "This" pointer
+ * @param value Value to record.
+ * @param expected_interval The delay between recording values.
+ * @return false if the value is out of range, true otherwise.
+ */
+bool hdr_percpu_recorder_record_corrected_value(
+    struct hdr_percpu_recorder* pr, int64_t value, int64_t expected_interval);
+
+/**
+ * Flip every slot and merge the values recorded since the last sample into
+ * one histogram.
+ *
+ * @param pr "This" pointer
+ * @param histogram A histogram with the same config to merge into, which is
+ * reset first, or NULL to allocate a new one.
+ * @return The merged histogram, or NULL if one could not be allocated.
+ */
+struct hdr_histogram* hdr_percpu_recorder_sample_and_recycle(
+    struct hdr_percpu_recorder* pr, struct hdr_histogram* histogram);
+
+/**
+ * As hdr_percpu_recorder_sample_and_recycle, merging into a histogram owned by
+ * the recorder, which is valid until the next call.
+ *
+ * @param pr "This" pointer
+ * @return The merged histogram.
+ */
+struct hdr_histogram* hdr_percpu_recorder_sample(struct hdr_percpu_recorder* pr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
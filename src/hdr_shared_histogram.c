@@ -0,0 +1,390 @@
+/**
+ * hdr_shared_histogram.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "hdr_histogram.h"
+#include "hdr_shared_histogram.h"
+#include "hdr_atomic.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+
+int hdr_shared_create(
+    const char* path,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_shared_histogram** result)
+{
+    (void) path;
+    (void) lowest_trackable_value;
+    (void) highest_trackable_value;
+    (void) significant_figures;
+    (void) result;
+    return ENOSYS;
+}
+
+int hdr_shared_create_shm(
+    const char* name,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_shared_histogram** result)
+{
+    return hdr_shared_create(name, lowest_trackable_value, highest_trackable_value, significant_figures, result);
+}
+
+int hdr_shared_open(
+    const char* path,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_shared_histogram** result)
+{
+    return hdr_shared_create(path, lowest_trackable_value, highest_trackable_value, significant_figures, result);
+}
+
+int hdr_shared_attach(const char* path, struct hdr_shared_histogram** result)
+{
+    (void) path;
+    (void) result;
+    return ENOSYS;
+}
+
+int hdr_shared_attach_shm(const char* name, struct hdr_shared_histogram** result)
+{
+    return hdr_shared_attach(name, result);
+}
+
+void hdr_shared_close(struct hdr_shared_histogram* s)
+{
+    (void) s;
+}
+
+int hdr_shared_sync(struct hdr_shared_histogram* s, bool async)
+{
+    (void) s;
+    (void) async;
+    return ENOSYS;
+}
+
+#else
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+/* Counts start on their own cache line, after the header. */
+#define HDR_SHARED_COUNTS_OFFSET 64
+
+static size_t mapping_size_for(int32_t counts_len)
+{
+    return HDR_SHARED_COUNTS_OFFSET + (size_t) counts_len * sizeof(int64_t);
+}
+
+static uint32_t header_checksum(const struct hdr_shared_header* header)
+{
+    struct hdr_shared_header copy = *header;
+    copy.magic = HDR_SHARED_MAGIC;
+    copy.header_checksum = 0;
+
+    return (uint32_t) crc32(0, (const Bytef*) &copy, sizeof(struct hdr_shared_header));
+}
+
+static int validate_header(
+    const struct hdr_shared_header* header, size_t size, struct hdr_histogram_bucket_config* cfg)
+{
+    if (size < sizeof(struct hdr_shared_header) ||
+        HDR_SHARED_MAGIC != hdr_atomic_load_64((int64_t*) &header->magic) ||
+        HDR_SHARED_VERSION != header->version ||
+        (int32_t) sizeof(struct hdr_shared_header) != header->header_size ||
+        (int32_t) sizeof(int64_t) != header->word_size ||
+        header_checksum(header) != header->header_checksum)
+    {
+        return EINVAL;
+    }
+
+    if (hdr_calculate_bucket_config(
+        header->lowest_trackable_value, header->highest_trackable_value, header->significant_figures, cfg) != 0 ||
+        cfg->counts_len != header->counts_len ||
+        header->counts_offset < header->header_size ||
+        0 != header->counts_offset % (int64_t) sizeof(int64_t) ||
+        (size_t) header->counts_offset + (size_t) cfg->counts_len * sizeof(int64_t) > size)
+    {
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+static int wrap_mapping(
+    int fd, void* mapping, size_t size, struct hdr_histogram_bucket_config* cfg, struct hdr_shared_histogram** result)
+{
+    struct hdr_shared_histogram* s = calloc(1, sizeof(struct hdr_shared_histogram));
+    if (!s)
+    {
+        munmap(mapping, size);
+        close(fd);
+        return ENOMEM;
+    }
+
+    s->header = (struct hdr_shared_header*) mapping;
+    s->histogram.counts = (int64_t*) ((uint8_t*) mapping + s->header->counts_offset);
+    hdr_init_preallocated(&s->histogram, cfg);
+    s->mapping_size = size;
+    s->fd = fd;
+
+    *result = s;
+
+    return 0;
+}
+
+static int create_from_fd(
+    int fd,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_shared_histogram** result)
+{
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_shared_header* header;
+    size_t size;
+    void* mapping;
+    int r;
+
+    r = hdr_calculate_bucket_config(lowest_trackable_value, highest_trackable_value, significant_figures, &cfg);
+    if (r)
+    {
+        close(fd);
+        return r;
+    }
+
+    size = mapping_size_for(cfg.counts_len);
+
+    /* Truncate first so that the counts are zero, even if the file existed. */
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t) size) != 0)
+    {
+        r = errno;
+        close(fd);
+        return r;
+    }
+
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == mapping)
+    {
+        r = errno;
+        close(fd);
+        return r;
+    }
+
+    header = (struct hdr_shared_header*) mapping;
+    header->version = HDR_SHARED_VERSION;
+    header->header_size = (int32_t) sizeof(struct hdr_shared_header);
+    header->lowest_trackable_value = cfg.lowest_trackable_value;
+    header->highest_trackable_value = cfg.highest_trackable_value;
+    header->significant_figures = (int32_t) cfg.significant_figures;
+    header->counts_len = cfg.counts_len;
+    header->word_size = (int32_t) sizeof(int64_t);
+    header->counts_offset = HDR_SHARED_COUNTS_OFFSET;
+    header->header_checksum = header_checksum(header);
+
+    /* Published last, readers that see the magic see the rest of the header. */
+    hdr_atomic_store_64(&header->magic, HDR_SHARED_MAGIC);
+
+    return wrap_mapping(fd, mapping, size, &cfg, result);
+}
+
+static int attach_to_fd(int fd, bool writable, struct hdr_shared_histogram** result)
+{
+    struct hdr_histogram_bucket_config cfg;
+    struct stat st;
+    size_t size;
+    void* mapping;
+    int r;
+
+    if (fstat(fd, &st) != 0)
+    {
+        r = errno;
+        close(fd);
+        return r;
+    }
+
+    size = (size_t) st.st_size;
+    if (size < sizeof(struct hdr_shared_header))
+    {
+        close(fd);
+        return EINVAL;
+    }
+
+    mapping = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == mapping)
+    {
+        r = errno;
+        close(fd);
+        return r;
+    }
+
+    r = validate_header((struct hdr_shared_header*) mapping, size, &cfg);
+    if (r)
+    {
+        munmap(mapping, size);
+        close(fd);
+        return r;
+    }
+
+    r = wrap_mapping(fd, mapping, size, &cfg, result);
+    if (0 == r)
+    {
+        hdr_shared_refresh(*result);
+    }
+
+    return r;
+}
+
+int hdr_shared_create(
+    const char* path,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_shared_histogram** result)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    return create_from_fd(fd, lowest_trackable_value, highest_trackable_value, significant_figures, result);
+}
+
+int hdr_shared_create_shm(
+    const char* name,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_shared_histogram** result)
+{
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    return create_from_fd(fd, lowest_trackable_value, highest_trackable_value, significant_figures, result);
+}
+
+int hdr_shared_open(
+    const char* path,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_shared_histogram** result)
+{
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_shared_histogram* s;
+    struct stat st;
+    int64_t magic = 0;
+    int fd, r;
+
+    r = hdr_calculate_bucket_config(lowest_trackable_value, highest_trackable_value, significant_figures, &cfg);
+    if (r)
+    {
+        return r;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    if (fstat(fd, &st) != 0)
+    {
+        r = errno;
+        close(fd);
+        return r;
+    }
+
+    /* A file that is empty, or was never completely created, is started afresh. */
+    if (st.st_size < (off_t) sizeof(magic) ||
+        (pread(fd, &magic, sizeof(magic), 0) == (ssize_t) sizeof(magic) && 0 == magic))
+    {
+        return create_from_fd(fd, lowest_trackable_value, highest_trackable_value, significant_figures, result);
+    }
+
+    r = attach_to_fd(fd, true, &s);
+    if (r)
+    {
+        return r;
+    }
+
+    if (s->header->lowest_trackable_value != cfg.lowest_trackable_value ||
+        s->header->highest_trackable_value != cfg.highest_trackable_value ||
+        s->header->significant_figures != (int32_t) cfg.significant_figures)
+    {
+        hdr_shared_close(s);
+        return EINVAL;
+    }
+
+    *result = s;
+
+    return 0;
+}
+
+int hdr_shared_attach(const char* path, struct hdr_shared_histogram** result)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    return attach_to_fd(fd, false, result);
+}
+
+int hdr_shared_attach_shm(const char* name, struct hdr_shared_histogram** result)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    return attach_to_fd(fd, false, result);
+}
+
+void hdr_shared_close(struct hdr_shared_histogram* s)
+{
+    munmap(s->header, s->mapping_size);
+    close(s->fd);
+    free(s);
+}
+
+int hdr_shared_sync(struct hdr_shared_histogram* s, bool async)
+{
+    if (msync(s->header, s->mapping_size, async ? MS_ASYNC : MS_SYNC) != 0)
+    {
+        return errno;
+    }
+
+    return 0;
+}
+
+#endif
+
+struct hdr_histogram* hdr_shared_histogram_get(struct hdr_shared_histogram* s)
+{
+    return &s->histogram;
+}
+
+void hdr_shared_refresh(struct hdr_shared_histogram* s)
+{
+    hdr_reset_internal_counters(&s->histogram);
+}
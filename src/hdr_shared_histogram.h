@@ -0,0 +1,177 @@
+/**
+ * hdr_shared_histogram.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A histogram whose counts live in a file or POSIX shared memory mapping, so
+ * that one process can record values while others attach read-only and query
+ * them in place, without encoding or copying the histogram.
+ *
+ * The mapping starts with a struct hdr_shared_header, describing the layout,
+ * followed by the counts as native endian 64 bit integers at counts_offset.
+ * Everything else about the histogram (min, max, total count) is derived from
+ * the counts by readers when they refresh.  The header carries a CRC-32 of its
+ * own fields, so a file can be reopened after a restart (hdr_shared_open) and
+ * recording continued without decoding anything.  Only supported on POSIX systems.
+ */
+
+#ifndef HDR_SHARED_HISTOGRAM_H
+#define HDR_SHARED_HISTOGRAM_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "hdr_histogram.h"
+
+#define HDR_SHARED_MAGIC INT64_C(0x1c84935048445253)
+#define HDR_SHARED_VERSION 1
+
+typedef struct hdr_shared_header
+{
+    int64_t magic;
+    int32_t version;
+    int32_t header_size;
+    int64_t lowest_trackable_value;
+    int64_t highest_trackable_value;
+    int32_t significant_figures;
+    int32_t counts_len;
+    int32_t word_size;
+    uint32_t header_checksum;
+    int64_t counts_offset;
+} hdr_shared_header_t;
+
+typedef struct hdr_shared_histogram
+{
+    struct hdr_histogram histogram;
+    struct hdr_shared_header* header;
+    size_t mapping_size;
+    int fd;
+} hdr_shared_histogram_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Create a histogram in the file at path, replacing any existing contents, and
+ * map it for recording.  Values should be recorded into hdr_shared_histogram_get
+ * with the atomic recording functions (e.g. hdr_record_value_atomic), so that
+ * readers see whole counts.
+ *
+ * @param path The file to create.
+ * @param lowest_trackable_value The smallest possible value to be put into the
+ * histogram.
+ * @param highest_trackable_value The largest possible value to be put into the
+ * histogram.
+ * @param significant_figures The level of precision for this histogram.
+ * @param result Output parameter to capture the shared histogram.
+ * @return 0 on success, EINVAL if the parameters are invalid, ENOSYS if shared
+ * histograms are not supported on this platform or the errno from a failed
+ * open, ftruncate or mmap.
+ */
+int hdr_shared_create(
+    const char* path,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_shared_histogram** result);
+
+/**
+ * As hdr_shared_create, but using the POSIX shared memory object name (see
+ * shm_open).  The object is left in place when closed, remove it with shm_unlink.
+ */
+int hdr_shared_create_shm(
+    const char* name,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_shared_histogram** result);
+
+/**
+ * Open the histogram in the file at path for recording, keeping the counts
+ * already in it, or create it if the file is new or empty.  Used for histograms
+ * that should persist across restarts: reopening maps the existing counts as
+ * they are, with only a scan for the total count, min and max.
+ *
+ * @param path The file to open or create.
+ * @param lowest_trackable_value The smallest possible value to be put into the
+ * histogram.
+ * @param highest_trackable_value The largest possible value to be put into the
+ * histogram.
+ * @param significant_figures The level of precision for this histogram.
+ * @param result Output parameter to capture the shared histogram.
+ * @return 0 on success, EINVAL if the parameters are invalid or the file holds a
+ * histogram with a different bucket config or a corrupt header, ENOSYS if shared
+ * histograms are not supported on this platform or the errno from a failed
+ * open, ftruncate or mmap.
+ */
+int hdr_shared_open(
+    const char* path,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_shared_histogram** result);
+
+/**
+ * Attach read-only to a histogram created with hdr_shared_create.  The layout is
+ * validated against the header before the counts are used.  Call
+ * hdr_shared_refresh before querying the histogram.
+ *
+ * @param path The file to attach to.
+ * @param result Output parameter to capture the shared histogram.
+ * @return 0 on success, EINVAL if the file is not a shared histogram, has an
+ * unsupported version or layout or its header checksum does not match, ENOSYS if shared histograms are not supported on
+ * this platform or the errno from a failed open or mmap.
+ */
+int hdr_shared_attach(const char* path, struct hdr_shared_histogram** result);
+
+/**
+ * As hdr_shared_attach, but using the POSIX shared memory object name.
+ */
+int hdr_shared_attach_shm(const char* name, struct hdr_shared_histogram** result);
+
+/**
+ * Unmap and free the shared histogram.  The file or shared memory object itself
+ * is kept.
+ *
+ * @param s The shared histogram to close.
+ */
+void hdr_shared_close(struct hdr_shared_histogram* s);
+
+/**
+ * Flush the counts to the underlying file with msync.  The operating system
+ * writes dirty pages back on its own schedule, so this is only needed to bound
+ * how much can be lost if the machine (rather than the process) fails.
+ *
+ * @param s "This" pointer
+ * @param async Schedule the write and return immediately (MS_ASYNC) rather than
+ * waiting for it to complete (MS_SYNC).
+ * @return 0 on success, ENOSYS if not supported on this platform or the errno
+ * from a failed msync.
+ */
+int hdr_shared_sync(struct hdr_shared_histogram* s, bool async);
+
+/**
+ * The histogram backed by the mapping.  For an attached histogram it is read-only:
+ * it may be queried but not recorded into or reset.
+ *
+ * @param s "This" pointer
+ * @return The histogram.
+ */
+struct hdr_histogram* hdr_shared_histogram_get(struct hdr_shared_histogram* s);
+
+/**
+ * Recalculate the total count, min and max of an attached histogram from the
+ * current counts in the mapping.  The counts keep changing while the writer
+ * records, so this should be called just before each set of queries.
+ *
+ * @param s "This" pointer
+ */
+void hdr_shared_refresh(struct hdr_shared_histogram* s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,247 @@
+/**
+ * hdr_snapshot.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "hdr_histogram.h"
+#include "hdr_snapshot.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+/* Counts start on their own cache line, directly after the header. */
+#define HDR_SNAPSHOT_COUNTS_OFFSET 64
+
+/* The header is written as is, so it must fill the space before the counts exactly. */
+typedef char hdr_snapshot_header_fills_counts_offset[
+    sizeof(struct hdr_snapshot_header) == HDR_SNAPSHOT_COUNTS_OFFSET ? 1 : -1];
+
+static uint32_t swap_32(uint32_t v)
+{
+    return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+static uint64_t swap_64(uint64_t v)
+{
+    return ((uint64_t) swap_32((uint32_t) v) << 32) | swap_32((uint32_t) (v >> 32));
+}
+
+int hdr_snapshot_header_init(const struct hdr_histogram* h, struct hdr_snapshot_header* header)
+{
+    if (NULL != h->packed_pages)
+    {
+        return EINVAL;
+    }
+
+    memset(header, 0, sizeof(struct hdr_snapshot_header));
+    header->cookie = HDR_SNAPSHOT_COOKIE;
+    header->endian_tag = HDR_SNAPSHOT_ENDIAN_TAG;
+    header->header_size = (int32_t) sizeof(struct hdr_snapshot_header);
+    header->significant_figures = h->significant_figures;
+    header->lowest_trackable_value = h->lowest_trackable_value;
+    header->highest_trackable_value = h->highest_trackable_value;
+    header->counts_len = h->counts_len;
+    header->normalizing_index_offset = h->normalizing_index_offset;
+    header->counts_offset = HDR_SNAPSHOT_COUNTS_OFFSET;
+    header->total_count = h->total_count;
+
+    return 0;
+}
+
+size_t hdr_snapshot_size(const struct hdr_histogram* h)
+{
+    return HDR_SNAPSHOT_COUNTS_OFFSET + (size_t) h->counts_len * sizeof(int64_t);
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+
+int hdr_snapshot_write(const struct hdr_histogram* h, int fd)
+{
+    (void) h;
+    (void) fd;
+    return ENOSYS;
+}
+
+#else
+
+int hdr_snapshot_write(const struct hdr_histogram* h, int fd)
+{
+    struct hdr_snapshot_header header;
+    struct iovec iov[2];
+    size_t remaining;
+    ssize_t written;
+    int r, i;
+
+    r = hdr_snapshot_header_init(h, &header);
+    if (r)
+    {
+        return r;
+    }
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = h->counts;
+    iov[1].iov_len = (size_t) h->counts_len * sizeof(int64_t);
+    remaining = iov[0].iov_len + iov[1].iov_len;
+
+    i = 0;
+    while (remaining > 0)
+    {
+        written = writev(fd, iov + i, 2 - i);
+        if (written < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            return errno;
+        }
+
+        /* Resume a short write from where it stopped. */
+        remaining -= (size_t) written;
+        while (i < 2 && (size_t) written >= iov[i].iov_len)
+        {
+            written -= (ssize_t) iov[i].iov_len;
+            i++;
+        }
+        if (i < 2)
+        {
+            iov[i].iov_base = (uint8_t*) iov[i].iov_base + written;
+            iov[i].iov_len -= (size_t) written;
+        }
+    }
+
+    return 0;
+}
+
+#endif
+
+static int read_header(const void* buffer, size_t length, struct hdr_snapshot_header* header, bool* swapped)
+{
+    if (length < sizeof(struct hdr_snapshot_header))
+    {
+        return EINVAL;
+    }
+
+    memcpy(header, buffer, sizeof(struct hdr_snapshot_header));
+
+    *swapped = swap_32(HDR_SNAPSHOT_ENDIAN_TAG) == header->endian_tag;
+    if (*swapped)
+    {
+        header->cookie = (int32_t) swap_32((uint32_t) header->cookie);
+        header->header_size = (int32_t) swap_32((uint32_t) header->header_size);
+        header->significant_figures = (int32_t) swap_32((uint32_t) header->significant_figures);
+        header->lowest_trackable_value = (int64_t) swap_64((uint64_t) header->lowest_trackable_value);
+        header->highest_trackable_value = (int64_t) swap_64((uint64_t) header->highest_trackable_value);
+        header->counts_len = (int32_t) swap_32((uint32_t) header->counts_len);
+        header->normalizing_index_offset = (int32_t) swap_32((uint32_t) header->normalizing_index_offset);
+        header->counts_offset = (int64_t) swap_64((uint64_t) header->counts_offset);
+        header->total_count = (int64_t) swap_64((uint64_t) header->total_count);
+    }
+    else if (HDR_SNAPSHOT_ENDIAN_TAG != header->endian_tag)
+    {
+        return EINVAL;
+    }
+
+    if (HDR_SNAPSHOT_COOKIE != header->cookie ||
+        header->header_size < (int32_t) sizeof(struct hdr_snapshot_header) ||
+        header->counts_offset < header->header_size ||
+        header->counts_len < 0 ||
+        header->normalizing_index_offset >= header->counts_len ||
+        header->normalizing_index_offset <= -header->counts_len ||
+        (uint64_t) header->counts_offset + (uint64_t) header->counts_len * sizeof(int64_t) > (uint64_t) length)
+    {
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+int hdr_snapshot_load_into(struct hdr_histogram* h, const void* buffer, size_t length)
+{
+    struct hdr_snapshot_header header;
+    const uint8_t* counts;
+    bool swapped;
+    int32_t i;
+    int r;
+
+    r = read_header(buffer, length, &header, &swapped);
+    if (r)
+    {
+        return r;
+    }
+
+    if (NULL != h->packed_pages ||
+        header.lowest_trackable_value != h->lowest_trackable_value ||
+        header.highest_trackable_value != h->highest_trackable_value ||
+        header.significant_figures != h->significant_figures ||
+        header.counts_len != h->counts_len)
+    {
+        return EINVAL;
+    }
+
+    counts = (const uint8_t*) buffer + header.counts_offset;
+    if (swapped)
+    {
+        for (i = 0; i < h->counts_len; i++)
+        {
+            uint64_t count;
+            memcpy(&count, counts + (size_t) i * sizeof(int64_t), sizeof(int64_t));
+            h->counts[i] = (int64_t) swap_64(count);
+        }
+    }
+    else
+    {
+        memcpy(h->counts, counts, (size_t) h->counts_len * sizeof(int64_t));
+    }
+
+    h->normalizing_index_offset = header.normalizing_index_offset;
+    hdr_reset_internal_counters(h);
+
+    if (h->total_count != header.total_count)
+    {
+        hdr_reset(h);
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+int hdr_snapshot_load(const void* buffer, size_t length, struct hdr_histogram** result)
+{
+    struct hdr_snapshot_header header;
+    struct hdr_histogram* h;
+    bool swapped;
+    int r;
+
+    r = read_header(buffer, length, &header, &swapped);
+    if (r)
+    {
+        return r;
+    }
+
+    r = hdr_init(header.lowest_trackable_value, header.highest_trackable_value, header.significant_figures, &h);
+    if (r)
+    {
+        return r;
+    }
+
+    r = hdr_snapshot_load_into(h, buffer, length);
+    if (r)
+    {
+        hdr_close(h);
+        return r;
+    }
+
+    *result = h;
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+/**
+ * hdr_snapshot.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * An uncompressed snapshot format for checkpointing histograms, much cheaper
+ * to produce than the compressed log encoding.  A snapshot is a 64 byte
+ * struct hdr_snapshot_header followed by the counts as 64 bit integers, both
+ * in the byte order of the machine that wrote them, which is recorded in the
+ * header's endian_tag.  Snapshots with a different byte order are swapped when
+ * loaded.  A native snapshot can also be mapped and used directly, with the
+ * counts at counts_offset and the layout from hdr_calculate_bucket_config.
+ */
+
+#ifndef HDR_SNAPSHOT_H
+#define HDR_SNAPSHOT_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "hdr_histogram.h"
+
+#define HDR_SNAPSHOT_COOKIE 0x1c849330
+#define HDR_SNAPSHOT_ENDIAN_TAG 0x01020304
+
+typedef struct hdr_snapshot_header
+{
+    int32_t cookie;
+    uint32_t endian_tag;
+    int32_t header_size;
+    int32_t significant_figures;
+    int64_t lowest_trackable_value;
+    int64_t highest_trackable_value;
+    int32_t counts_len;
+    int32_t normalizing_index_offset;
+    int64_t counts_offset;
+    int64_t total_count;
+    int64_t reserved;
+} hdr_snapshot_header_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Fill in the snapshot header for the histogram.  The snapshot is the header
+ * followed by the h->counts_len entries of h->counts, e.g. written out with a
+ * single writev.
+ *
+ * @param h The histogram to snapshot.
+ * @param header The header to fill in.
+ * @return 0 on success, EINVAL if the histogram is packed or paged and has no
+ * flat array of counts.
+ */
+int hdr_snapshot_header_init(const struct hdr_histogram* h, struct hdr_snapshot_header* header);
+
+/**
+ * The size in bytes of a snapshot of the histogram.
+ *
+ * @param h The histogram to snapshot.
+ * @return The snapshot size.
+ */
+size_t hdr_snapshot_size(const struct hdr_histogram* h);
+
+/**
+ * Write a snapshot of the histogram to a file descriptor, using writev.
+ *
+ * @param h The histogram to snapshot.
+ * @param fd The file descriptor to write to.
+ * @return 0 on success, EINVAL if the histogram has no flat array of counts,
+ * ENOSYS if not supported on this platform, or the errno from a failed write.
+ */
+int hdr_snapshot_write(const struct hdr_histogram* h, int fd);
+
+/**
+ * Allocate a histogram and load a snapshot into it.
+ *
+ * @param buffer The snapshot.
+ * @param length The length of the snapshot in bytes.
+ * @param result Output parameter to capture the allocated histogram.
+ * @return 0 on success, EINVAL if the buffer does not hold a valid snapshot,
+ * ENOMEM if the allocation failed.
+ */
+int hdr_snapshot_load(const void* buffer, size_t length, struct hdr_histogram** result);
+
+/**
+ * Load a snapshot into an existing histogram with the same bucket config,
+ * replacing all of its counts.
+ *
+ * @param h The histogram to load into.
+ * @param buffer The snapshot.
+ * @param length The length of the snapshot in bytes.
+ * @return 0 on success, EINVAL if the buffer does not hold a valid snapshot or
+ * the histogram has a different bucket config or no flat array of counts.  If
+ * the counts do not add up to the total in the header h is left empty.
+ */
+int hdr_snapshot_load_into(struct hdr_histogram* h, const void* buffer, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+/**
+ * hdr_striped_histogram.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "hdr_histogram.h"
+#include "hdr_striped_histogram.h"
+#include "hdr_internal.h"
+
+int hdr_striped_histogram_init(
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    int32_t stripe_count,
+    struct hdr_striped_histogram** result)
+{
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_striped_histogram* s;
+    size_t header_stride, counts_stride;
+    uint8_t* base;
+    int32_t i;
+
+    int r = hdr_calculate_bucket_config(lowest_trackable_value, highest_trackable_value, significant_figures, &cfg);
+    if (r)
+    {
+        return r;
+    }
+
+    if (stripe_count < 1)
+    {
+        return EINVAL;
+    }
+
+    header_stride = hdr_round_up_to(sizeof(struct hdr_histogram), HDR_CACHE_LINE_SIZE);
+    counts_stride = hdr_round_up_to((size_t) cfg.counts_len * sizeof(int64_t), HDR_CACHE_LINE_SIZE);
+
+    s = calloc(1, sizeof(struct hdr_striped_histogram));
+    if (!s)
+    {
+        return ENOMEM;
+    }
+
+    /* One block for everything, over allocated by a cache line so it can be aligned. */
+    s->allocation = calloc(1, (header_stride + counts_stride) * (size_t) stripe_count + HDR_CACHE_LINE_SIZE);
+    if (!s->allocation)
+    {
+        free(s);
+        return ENOMEM;
+    }
+
+    base = hdr_align_to_cache_line(s->allocation);
+
+    s->stripe_count = stripe_count;
+    s->stripe_stride = header_stride;
+    s->stripes = base;
+
+    for (i = 0; i < stripe_count; i++)
+    {
+        struct hdr_histogram* h = (struct hdr_histogram*) (base + header_stride * (size_t) i);
+        h->counts = (int64_t*) (base + header_stride * (size_t) stripe_count + counts_stride * (size_t) i);
+        hdr_init_preallocated(h, &cfg);
+    }
+
+    *result = s;
+
+    return 0;
+}
+
+void hdr_striped_histogram_close(struct hdr_striped_histogram* s)
+{
+    free(s->allocation);
+    free(s);
+}
+
+struct hdr_histogram* hdr_striped_histogram_stripe(struct hdr_striped_histogram* s, uint32_t stripe)
+{
+    struct hdr_histogram* h =
+        (struct hdr_histogram*) (s->stripes + s->stripe_stride * (stripe % (uint32_t) s->stripe_count));
+
+    /* Resizing would reallocate counts that live inside s->allocation. */
+    assert(!h->auto_resize);
+
+    return h;
+}
+
+void hdr_striped_histogram_reset(struct hdr_striped_histogram* s)
+{
+    int32_t i;
+    for (i = 0; i < s->stripe_count; i++)
+    {
+        hdr_reset(hdr_striped_histogram_stripe(s, (uint32_t) i));
+    }
+}
+
+bool hdr_striped_histogram_record_value(struct hdr_striped_histogram* s, uint32_t stripe, int64_t value)
+{
+    return hdr_record_values(hdr_striped_histogram_stripe(s, stripe), value, 1);
+}
+
+bool hdr_striped_histogram_record_values(
+    struct hdr_striped_histogram* s, uint32_t stripe, int64_t value, int64_t count)
+{
+    return hdr_record_values(hdr_striped_histogram_stripe(s, stripe), value, count);
+}
+
+int64_t hdr_striped_histogram_merge(struct hdr_striped_histogram* s, struct hdr_histogram* h)
+{
+    int64_t dropped = 0;
+    int32_t i;
+
+    for (i = 0; i < s->stripe_count; i++)
+    {
+        dropped += hdr_add(h, hdr_striped_histogram_stripe(s, (uint32_t) i));
+    }
+
+    return dropped;
+}
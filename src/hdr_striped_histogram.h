@@ -0,0 +1,120 @@
+/**
+ * hdr_striped_histogram.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A striped histogram spreads recording over a number of independent
+ * hdr_histograms (stripes).  Each stripe header and counts array sits on its
+ * own cache lines, so writers using different stripes never share a cache
+ * line and can use plain, non-atomic updates.  Readers merge the stripes into
+ * a regular hdr_histogram to run percentile, mean and iterator queries.
+ */
+
+#ifndef HDR_STRIPED_HISTOGRAM_H
+#define HDR_STRIPED_HISTOGRAM_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hdr_histogram.h"
+
+typedef struct hdr_striped_histogram
+{
+    int32_t stripe_count;
+    size_t stripe_stride;
+    uint8_t* stripes;
+    void* allocation;
+} hdr_striped_histogram_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allocate the memory and initialise the striped histogram.  All stripes
+ * share the same bucket configuration.
+ *
+ * @param lowest_trackable_value The smallest possible value to be put into the
+ * histogram.
+ * @param highest_trackable_value The largest possible value to be put into the
+ * histogram.
+ * @param significant_figures The level of precision for this histogram.
+ * @param stripe_count The number of stripes, typically the number of writer threads.
+ * @param result Output parameter to capture allocated histogram.
+ * @return 0 on success, EINVAL if any of the parameters are invalid, ENOMEM if
+ * the allocation failed.
+ */
+int hdr_striped_histogram_init(
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    int32_t stripe_count,
+    struct hdr_striped_histogram** result);
+
+/**
+ * Free the memory and close the striped histogram.
+ *
+ * @param s The striped histogram you want to close.
+ */
+void hdr_striped_histogram_close(struct hdr_striped_histogram* s);
+
+/**
+ * Reset all of the stripes to zero.
+ *
+ * @param s "This" pointer
+ */
+void hdr_striped_histogram_reset(struct hdr_striped_histogram* s);
+
+/**
+ * Get the histogram backing a stripe.  The stripe is taken modulo the
+ * stripe count, so a thread id or any other per-thread number may be used.
+ * A stripe must only be recorded into by one thread at a time.  The stripes
+ * share a single allocation owned by the striped histogram, so they can't be
+ * resized and auto-resizing (hdr_set_auto_resize) must not be enabled on them.
+ *
+ * @param s "This" pointer
+ * @param stripe The stripe to get
+ * @return The histogram for the stripe.
+ */
+struct hdr_histogram* hdr_striped_histogram_stripe(struct hdr_striped_histogram* s, uint32_t stripe);
+
+/**
+ * Records a value in the given stripe.
+ *
+ * @param s "This" pointer
+ * @param stripe The stripe to record into, see hdr_striped_histogram_stripe.
+ * @param value Value to add to the histogram
+ * @return false if the value is larger than the highest_trackable_value and can't be recorded,
+ * true otherwise.
+ */
+bool hdr_striped_histogram_record_value(struct hdr_striped_histogram* s, uint32_t stripe, int64_t value);
+
+/**
+ * Records count values in the given stripe.
+ *
+ * @param s "This" pointer
+ * @param stripe The stripe to record into, see hdr_striped_histogram_stripe.
+ * @param value Value to add to the histogram
+ * @param count Number of 'value's to add to the histogram
+ * @return false if the value is larger than the highest_trackable_value and can't be recorded,
+ * true otherwise.
+ */
+bool hdr_striped_histogram_record_values(
+    struct hdr_striped_histogram* s, uint32_t stripe, int64_t value, int64_t count);
+
+/**
+ * Adds the values from all of the stripes to 'h'.  If the stripes are being
+ * written to concurrently the merged view is only weakly consistent, each
+ * count is read once but recording may continue while merging.
+ *
+ * @param s "This" pointer
+ * @param h The histogram to merge into.
+ * @return The number of values dropped when merging.
+ */
+int64_t hdr_striped_histogram_merge(struct hdr_striped_histogram* s, struct hdr_histogram* h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -12,6 +12,8 @@ extern "C" {
 int32_t counts_index_for(const struct hdr_histogram* h, int64_t value);
 int hdr_encode_compressed(struct hdr_histogram* h, uint8_t** compressed_histogram, size_t* compressed_len);
 int hdr_decode_compressed(uint8_t* buffer, size_t length, struct hdr_histogram** histogram);
+int hdr_decode_compressed_with_allocator(
+    uint8_t* buffer, size_t length, struct hdr_histogram** histogram, const struct hdr_allocator* allocator);
 void hdr_base64_decode_block(const char* input, uint8_t* output);
 void hdr_base64_encode_block(const uint8_t* input, char* output);
 
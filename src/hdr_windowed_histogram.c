@@ -0,0 +1,126 @@
+/**
+ * hdr_windowed_histogram.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "hdr_histogram.h"
+#include "hdr_interval_recorder.h"
+#include "hdr_windowed_histogram.h"
+
+int hdr_windowed_histogram_init(
+    struct hdr_windowed_histogram* w,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    int32_t slot_count)
+{
+    int32_t i;
+    int rc;
+
+    w->slots = NULL;
+    w->aggregate = NULL;
+    w->slot_count = 0;
+    w->oldest_slot = 0;
+
+    if (slot_count < 1)
+    {
+        return EINVAL;
+    }
+
+    rc = hdr_interval_recorder_init_all(
+        &w->recorder, lowest_trackable_value, highest_trackable_value, significant_figures);
+    if (rc)
+    {
+        return rc;
+    }
+
+    w->slots = calloc((size_t) slot_count, sizeof(struct hdr_histogram*));
+    if (!w->slots)
+    {
+        hdr_interval_recorder_destroy(&w->recorder);
+        return ENOMEM;
+    }
+    w->slot_count = slot_count;
+
+    rc = hdr_init(lowest_trackable_value, highest_trackable_value, significant_figures, &w->aggregate);
+    for (i = 0; 0 == rc && i < slot_count; i++)
+    {
+        rc = hdr_init(lowest_trackable_value, highest_trackable_value, significant_figures, &w->slots[i]);
+    }
+
+    if (rc)
+    {
+        hdr_windowed_histogram_destroy(w);
+    }
+
+    return rc;
+}
+
+void hdr_windowed_histogram_destroy(struct hdr_windowed_histogram* w)
+{
+    int32_t i;
+
+    for (i = 0; i < w->slot_count; i++)
+    {
+        if (w->slots[i])
+        {
+            hdr_close(w->slots[i]);
+        }
+    }
+
+    if (w->aggregate)
+    {
+        hdr_close(w->aggregate);
+    }
+
+    free(w->slots);
+    hdr_interval_recorder_destroy(&w->recorder);
+
+    w->slots = NULL;
+    w->aggregate = NULL;
+    w->slot_count = 0;
+}
+
+bool hdr_windowed_histogram_record_value(struct hdr_windowed_histogram* w, int64_t value)
+{
+    return 0 != hdr_interval_recorder_record_value(&w->recorder, value);
+}
+
+bool hdr_windowed_histogram_record_value_atomic(struct hdr_windowed_histogram* w, int64_t value)
+{
+    return 0 != hdr_interval_recorder_record_value_atomic(&w->recorder, value);
+}
+
+int hdr_windowed_histogram_rotate(struct hdr_windowed_histogram* w)
+{
+    struct hdr_histogram* expired = w->slots[w->oldest_slot];
+    struct hdr_histogram* finished;
+    int rc;
+
+    rc = hdr_subtract(w->aggregate, expired);
+    if (rc)
+    {
+        return rc;
+    }
+
+    /* The expired slot becomes the recorder's new active histogram. */
+    hdr_reset(expired);
+    finished = hdr_interval_recorder_sample_and_recycle(&w->recorder, expired);
+
+    hdr_add(w->aggregate, finished);
+
+    w->slots[w->oldest_slot] = finished;
+    w->oldest_slot = (w->oldest_slot + 1) % w->slot_count;
+
+    return 0;
+}
+
+const struct hdr_histogram* hdr_windowed_histogram_aggregate(const struct hdr_windowed_histogram* w)
+{
+    return w->aggregate;
+}
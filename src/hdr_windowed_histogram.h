@@ -0,0 +1,111 @@
+/**
+ * hdr_windowed_histogram.h
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A windowed histogram holds the values recorded over the last N intervals,
+ * e.g. the last 60 seconds with one second slots.  Values are recorded through
+ * an hdr_interval_recorder.  On each rotation the interval just finished is
+ * added to a running aggregate and the interval falling out of the window is
+ * subtracted from it, so rotating costs one add and one subtract regardless of
+ * the number of slots, and queries run directly against the aggregate.
+ */
+
+#ifndef HDR_WINDOWED_HISTOGRAM_H
+#define HDR_WINDOWED_HISTOGRAM_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hdr_histogram.h"
+#include "hdr_interval_recorder.h"
+
+typedef struct hdr_windowed_histogram
+{
+    struct hdr_interval_recorder recorder;
+    struct hdr_histogram** slots;
+    struct hdr_histogram* aggregate;
+    int32_t slot_count;
+    int32_t oldest_slot;
+} hdr_windowed_histogram_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allocate the memory and initialise the windowed histogram.  All of the
+ * histograms are allocated up front, so rotating never allocates.
+ *
+ * @param w The windowed histogram to initialise.
+ * @param lowest_trackable_value The smallest possible value to be put into the
+ * histogram.
+ * @param highest_trackable_value The largest possible value to be put into the
+ * histogram.
+ * @param significant_figures The level of precision for this histogram.
+ * @param slot_count The number of intervals covered by the window.
+ * @return 0 on success, EINVAL if any of the parameters are invalid, ENOMEM if
+ * the allocation failed.
+ */
+int hdr_windowed_histogram_init(
+    struct hdr_windowed_histogram* w,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    int32_t slot_count);
+
+/**
+ * Free the memory held by the windowed histogram.
+ *
+ * @param w The windowed histogram to destroy.
+ */
+void hdr_windowed_histogram_destroy(struct hdr_windowed_histogram* w);
+
+/**
+ * Record a value into the current interval.  Safe to call from a single writer
+ * thread concurrently with rotation, use the _atomic variant for multiple writers.
+ * The other recording functions are available through w->recorder.
+ *
+ * @param w "This" pointer
+ * @param value Value to add to the histogram
+ * @return false if the value is larger than the highest_trackable_value and can't be recorded,
+ * true otherwise.
+ */
+bool hdr_windowed_histogram_record_value(struct hdr_windowed_histogram* w, int64_t value);
+
+/**
+ * Record a value into the current interval from any number of writer threads.
+ *
+ * @param w "This" pointer
+ * @param value Value to add to the histogram
+ * @return false if the value is larger than the highest_trackable_value and can't be recorded,
+ * true otherwise.
+ */
+bool hdr_windowed_histogram_record_value_atomic(struct hdr_windowed_histogram* w, int64_t value);
+
+/**
+ * Ends the current interval: its values are added to the window and the values
+ * of the oldest interval are removed.  Called by a single reader thread, once
+ * per interval.
+ *
+ * @param w "This" pointer
+ * @return 0 on success, or the error from hdr_subtract if the aggregate no
+ * longer holds the expired interval (e.g. it was modified by the caller).
+ */
+int hdr_windowed_histogram_rotate(struct hdr_windowed_histogram* w);
+
+/**
+ * The histogram of all values recorded in the last slot_count completed
+ * intervals.  It is owned by the windowed histogram and only changes on
+ * rotation, so it can be queried from the rotating thread without copying.
+ *
+ * @param w "This" pointer
+ * @return The aggregate histogram.
+ */
+const struct hdr_histogram* hdr_windowed_histogram_aggregate(const struct hdr_windowed_histogram* w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
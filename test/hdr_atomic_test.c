@@ -72,12 +72,28 @@ static char* test_add()
     return 0;
 }
 
+static char* test_compare_exchange()
+{
+    int64_t val1 = 123124;
+    int64_t val2 = 987234;
+    int64_t p = val1;
+
+    mu_assert("Should fail hdr_atomic_compare_exchange_64", !hdr_atomic_compare_exchange_64(&p, val2, val2));
+    mu_assert("Failed hdr_atomic_compare_exchange_64", compare_int64(p, val1));
+
+    mu_assert("Should pass hdr_atomic_compare_exchange_64", hdr_atomic_compare_exchange_64(&p, val1, val2));
+    mu_assert("Failed hdr_atomic_compare_exchange_64", compare_int64(p, val2));
+
+    return 0;
+}
+
 static struct mu_result all_tests()
 {
     mu_run_test(test_store_load_64);
     mu_run_test(test_store_load_pointer);
     mu_run_test(test_exchange);
     mu_run_test(test_add);
+    mu_run_test(test_compare_exchange);
 
     mu_ok;
 }
@@ -0,0 +1,214 @@
+/**
+ * hdr_dbl_histogram_test.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include <stdio.h>
+#include "hdr_time.h"
+#include <hdr_histogram.h>
+#include <hdr_histogram_log.h>
+#include <hdr_dbl_histogram.h>
+
+#include "minunit.h"
+
+int tests_run = 0;
+
+static bool compare_values(double a, double b, double variation)
+{
+    return compare_double(a, b, b * variation);
+}
+
+static char* test_invalid_init()
+{
+    struct hdr_dbl_histogram* h = NULL;
+
+    mu_assert("Should reject ratio < 2", EINVAL == hdr_dbl_init(1, 3, &h));
+    mu_assert("Should reject significant figures > 5", EINVAL == hdr_dbl_init(1000, 6, &h));
+    mu_assert("Should reject significant figures < 1", EINVAL == hdr_dbl_init(1000, 0, &h));
+    mu_assert("Should reject too large a range", EINVAL == hdr_dbl_init(INT64_C(1) << 50, 5, &h));
+
+    return 0;
+}
+
+static char* test_record_values()
+{
+    struct hdr_dbl_histogram* h;
+    int i;
+
+    mu_assert("Should init", 0 == hdr_dbl_init(INT64_C(1000000), 3, &h));
+
+    for (i = 1; i <= 10000; i++)
+    {
+        mu_assert("Should record", hdr_dbl_record_value(h, i / 1000.0));
+    }
+
+    mu_assert("Total count", compare_int64(h->values.total_count, 10000));
+    mu_assert("Min", compare_values(hdr_dbl_min(h), 0.001, 0.001));
+    mu_assert("Max", compare_values(hdr_dbl_max(h), 10.0, 0.001));
+    mu_assert("p50", compare_values(hdr_dbl_value_at_percentile(h, 50.0), 5.0, 0.001));
+    mu_assert("p99", compare_values(hdr_dbl_value_at_percentile(h, 99.0), 9.9, 0.001));
+    mu_assert("Mean", compare_values(hdr_dbl_mean(h), 5.0005, 0.001));
+    mu_assert("Stddev", compare_values(hdr_dbl_stddev(h), 2.8867, 0.001));
+    mu_assert("Count at value", compare_int64(hdr_dbl_count_at_value(h, 0.5), 1));
+
+    mu_assert("Should reject negative values", !hdr_dbl_record_value(h, -1.0));
+    mu_assert("Should reject NaN", !hdr_dbl_record_value(h, sqrt(-1.0)));
+    mu_assert("Should record zero", hdr_dbl_record_value(h, 0.0));
+
+    hdr_dbl_reset(h);
+    mu_assert("Reset", compare_int64(h->values.total_count, 0));
+
+    hdr_dbl_close(h);
+
+    return 0;
+}
+
+static char* test_auto_shift()
+{
+    struct hdr_dbl_histogram* h;
+
+    mu_assert("Should init", 0 == hdr_dbl_init(1000, 3, &h));
+
+    mu_assert("Should record", hdr_dbl_record_value(h, 5.0));
+    mu_assert("Should shift up", hdr_dbl_record_value(h, 2000.0));
+    mu_assert("Should shift down", hdr_dbl_record_value(h, 2.5));
+    mu_assert("Lowest covers 2.5", h->current_lowest_value <= 2.5);
+    mu_assert("Highest covers 2000", h->current_highest_value > 2000.0);
+
+    mu_assert("Min", compare_values(hdr_dbl_min(h), 2.5, 0.001));
+    mu_assert("Max", compare_values(hdr_dbl_max(h), 2000.0, 0.001));
+    mu_assert("Count at 5", compare_int64(hdr_dbl_count_at_value(h, 5.0), 1));
+
+    mu_assert("Should not cover beyond the ratio", !hdr_dbl_record_value(h, 1000000.0));
+    mu_assert("Should not cover below the ratio", !hdr_dbl_record_value(h, 0.0001));
+    mu_assert("Total count", compare_int64(h->values.total_count, 3));
+
+    hdr_dbl_reset(h);
+    mu_assert("Should shift when empty", hdr_dbl_record_value(h, 1.0e12));
+    mu_assert("Large value", compare_values(hdr_dbl_max(h), 1.0e12, 0.001));
+
+    hdr_dbl_close(h);
+
+    return 0;
+}
+
+static char* test_add_and_corrected()
+{
+    struct hdr_dbl_histogram* h;
+    struct hdr_dbl_histogram* other;
+
+    hdr_dbl_init(INT64_C(1000000), 3, &h);
+    hdr_dbl_init(INT64_C(1000000), 3, &other);
+
+    hdr_dbl_record_values(h, 0.25, 100);
+    hdr_dbl_record_values(other, 250.0, 100);
+
+    mu_assert("Should add", compare_int64(hdr_dbl_add(h, other), 0));
+    mu_assert("Total count", compare_int64(h->values.total_count, 200));
+    mu_assert("p25", compare_values(hdr_dbl_value_at_percentile(h, 25.0), 0.25, 0.001));
+    mu_assert("p75", compare_values(hdr_dbl_value_at_percentile(h, 75.0), 250.0, 0.001));
+
+    hdr_dbl_reset(other);
+    mu_assert("Should record corrected", hdr_dbl_record_corrected_value(other, 1.0, 0.1));
+    mu_assert("Corrected count", compare_int64(other->values.total_count, 10));
+    mu_assert("Corrected min", compare_values(hdr_dbl_min(other), 0.1, 0.01));
+
+    hdr_dbl_close(h);
+    hdr_dbl_close(other);
+
+    return 0;
+}
+
+static char* test_encode_and_decode()
+{
+    struct hdr_dbl_histogram* h;
+    struct hdr_dbl_histogram* decoded = NULL;
+    struct hdr_dbl_histogram* read = NULL;
+    hdr_log_writer_t writer;
+    hdr_log_reader_t reader;
+    hdr_timespec_t start, end, timestamp, interval;
+    char* encoded = NULL;
+    FILE* f;
+    int i;
+
+    hdr_dbl_init(INT64_C(1000000), 3, &h);
+    for (i = 1; i <= 1000; i++)
+    {
+        hdr_dbl_record_value(h, i * 0.37);
+    }
+
+    mu_assert("Should encode", 0 == hdr_dbl_log_encode(h, &encoded));
+    mu_assert("Should decode", 0 == hdr_dbl_log_decode(&decoded, encoded, strlen(encoded)));
+    mu_assert("Decoded count", compare_int64(decoded->values.total_count, 1000));
+    mu_assert("Decoded p50",
+              compare_values(hdr_dbl_value_at_percentile(decoded, 50.0), hdr_dbl_value_at_percentile(h, 50.0), 0.000001));
+    mu_assert("Decoded max", compare_values(hdr_dbl_max(decoded), hdr_dbl_max(h), 0.000001));
+
+    mu_assert("Should merge", 0 == hdr_dbl_log_decode(&decoded, encoded, strlen(encoded)));
+    mu_assert("Merged count", compare_int64(decoded->values.total_count, 2000));
+
+    f = tmpfile();
+    mu_assert("Could not open file", f != NULL);
+
+    hdr_log_writer_init(&writer);
+    hdr_log_reader_init(&reader);
+    hdr_getnow(&start);
+    hdr_getnow(&end);
+
+    mu_assert("Should write", 0 == hdr_dbl_log_write(&writer, f, &start, &end, h));
+    rewind(f);
+    mu_assert("Should read", 0 == hdr_dbl_log_read(&reader, f, &read, &timestamp, &interval));
+    mu_assert("Read count", compare_int64(read->values.total_count, 1000));
+    mu_assert("Read p99",
+              compare_values(hdr_dbl_value_at_percentile(read, 99.0), hdr_dbl_value_at_percentile(h, 99.0), 0.000001));
+
+    fclose(f);
+    free(encoded);
+    hdr_dbl_close(h);
+    hdr_dbl_close(decoded);
+    hdr_dbl_close(read);
+
+    return 0;
+}
+
+static struct mu_result all_tests()
+{
+    mu_run_test(test_invalid_init);
+    mu_run_test(test_record_values);
+    mu_run_test(test_auto_shift);
+    mu_run_test(test_add_and_corrected);
+    mu_run_test(test_encode_and_decode);
+
+    mu_ok;
+}
+
+static int hdr_dbl_histogram_run_tests()
+{
+    struct mu_result result = all_tests();
+
+    if (result.message != 0)
+    {
+        printf("hdr_dbl_histogram_test.%s(): %s\n", result.test, result.message);
+    }
+    else
+    {
+        printf("ALL TESTS PASSED\n");
+    }
+
+    printf("Tests run: %d\n", tests_run);
+
+    return result.message == NULL ? 0 : -1;
+}
+
+int main()
+{
+    return hdr_dbl_histogram_run_tests();
+}
@@ -257,15 +257,190 @@ static char* test_encode_and_decode_compressed2()
     return 0;
 }
 
+static char* test_encode_and_decode_packed()
+{
+    uint8_t* buffer = NULL;
+    uint8_t* packed_buffer = NULL;
+    size_t len = 0;
+    size_t packed_len = 0;
+    int rc = 0;
+    int i;
+    struct hdr_histogram* actual = NULL;
+    struct hdr_histogram* packed = NULL;
+
+    load_histograms();
+
+    rc = hdr_init_packed(1, INT64_C(3600) * 1000 * 1000, 3, &packed);
+    mu_assert("Did not allocate", validate_return_code(rc));
+
+    for (i = 0; i < 10000; i++)
+    {
+        hdr_record_corrected_value(packed, 1000, 10000);
+    }
+    hdr_record_corrected_value(packed, 100000000, 10000);
+
+    rc = hdr_encode_compressed(cor_histogram, &buffer, &len);
+    mu_assert("Did not encode", validate_return_code(rc));
+
+    rc = hdr_encode_compressed(packed, &packed_buffer, &packed_len);
+    mu_assert("Did not encode packed", validate_return_code(rc));
+
+    mu_assert("Encoded length should match", len == packed_len);
+    mu_assert("Encoding should match", memcmp(buffer, packed_buffer, len) == 0);
+
+    rc = hdr_decode_compressed(packed_buffer, packed_len, &actual);
+    mu_assert("Did not decode", validate_return_code(rc));
+
+    mu_assert(
+        "Comparison did not match",
+        compare_histogram(cor_histogram, actual));
+
+    free(buffer);
+    free(packed_buffer);
+    hdr_close(packed);
+    free(actual);
+
+    return 0;
+}
+
+static char* test_decode_into_auto_resize()
+{
+    uint8_t* buffer = NULL;
+    size_t len = 0;
+    int rc = 0;
+    struct hdr_histogram* actual = NULL;
+
+    load_histograms();
+
+    rc = hdr_init(1, 1000, 3, &actual);
+    mu_assert("Did not allocate", validate_return_code(rc));
+    hdr_set_auto_resize(actual, true);
+
+    rc = hdr_encode_compressed(cor_histogram, &buffer, &len);
+    mu_assert("Did not encode", validate_return_code(rc));
+
+    rc = hdr_decode_compressed(buffer, len, &actual);
+    mu_assert("Did not decode", validate_return_code(rc));
+
+    mu_assert("Total count", compare_int64(actual->total_count, cor_histogram->total_count));
+    mu_assert("Max", compare_int64(hdr_max(actual), hdr_max(cor_histogram)));
+    mu_assert(
+        "p99",
+        compare_int64(hdr_value_at_percentile(actual, 99.0), hdr_value_at_percentile(cor_histogram, 99.0)));
+
+    free(buffer);
+    hdr_close(actual);
+
+    return 0;
+}
+
+struct counting_allocator
+{
+    int64_t allocations;
+    int64_t frees;
+};
+
+static void* counting_malloc(void* context, size_t size)
+{
+    ((struct counting_allocator*) context)->allocations++;
+    return malloc(size);
+}
+
+static void* counting_calloc(void* context, size_t count, size_t size)
+{
+    ((struct counting_allocator*) context)->allocations++;
+    return calloc(count, size);
+}
+
+static void counting_free(void* context, void* ptr)
+{
+    ((struct counting_allocator*) context)->frees++;
+    free(ptr);
+}
+
+static char* test_decode_with_allocator()
+{
+    struct counting_allocator counter = { 0, 0 };
+    struct hdr_allocator allocator;
+    struct hdr_histogram* actual = NULL;
+    char* encoded = NULL;
+    int rc = 0;
+
+    allocator.malloc_fn = counting_malloc;
+    allocator.calloc_fn = counting_calloc;
+    allocator.free_fn = counting_free;
+    allocator.context = &counter;
+
+    load_histograms();
+
+    rc = hdr_log_encode(cor_histogram, &encoded);
+    mu_assert("Did not encode", validate_return_code(rc));
+
+    rc = hdr_log_decode_with_allocator(&actual, encoded, strlen(encoded), &allocator);
+    mu_assert("Did not decode", validate_return_code(rc));
+    mu_assert("Should use the allocator", counter.allocations > 0);
+    mu_assert("Histogram should have the allocator", actual->allocator == &allocator);
+    mu_assert("Not equal", compare_histogram(cor_histogram, actual));
+
+    rc = hdr_log_decode_with_allocator(&actual, encoded, strlen(encoded), &allocator);
+    mu_assert("Did not merge", validate_return_code(rc));
+    mu_assert("Merged count", compare_int64(actual->total_count, 2 * cor_histogram->total_count));
+
+    hdr_close(actual);
+    mu_assert("Should free everything allocated", compare_int64(counter.frees, counter.allocations));
+
+    free(encoded);
+
+    return 0;
+}
+
+static char* test_encode_and_decode_shifted()
+{
+    uint8_t* buffer = NULL;
+    size_t len = 0;
+    int rc = 0;
+    int i;
+    struct hdr_histogram* actual = NULL;
+    struct hdr_histogram* expected = NULL;
+    struct hdr_histogram* shifted = NULL;
+
+    hdr_alloc(INT64_C(3600) * 1000 * 1000, 3, &expected);
+    hdr_alloc(INT64_C(3600) * 1000 * 1000, 3, &shifted);
+
+    for (i = 1; i <= 1000; i++)
+    {
+        hdr_record_value(shifted, i * 10000);
+        hdr_record_value(expected, (i * 10000) >> 2);
+    }
+
+    mu_assert("Should shift", 0 == hdr_shift_values_right(shifted, 2));
+
+    rc = hdr_encode_compressed(shifted, &buffer, &len);
+    mu_assert("Did not encode", validate_return_code(rc));
+
+    rc = hdr_decode_compressed(buffer, len, &actual);
+    mu_assert("Did not decode", validate_return_code(rc));
+
+    mu_assert("Comparison did not match", compare_histogram(expected, actual));
+
+    free(buffer);
+    hdr_close(expected);
+    hdr_close(shifted);
+    free(actual);
+
+    return 0;
+}
+
 static char* test_bounds_check_on_decode()
 {
     uint8_t* buffer = NULL;
     size_t len = 0;
     int rc = 0;
     struct hdr_histogram* actual = NULL;
-    struct hdr_histogram* expected = cor_histogram;
+    struct hdr_histogram* expected;
 
     load_histograms();
+    expected = cor_histogram;
 
     rc = hdr_encode_compressed(expected, &buffer, &len);
     mu_assert("Did not encode", validate_return_code(rc));
@@ -916,6 +1091,10 @@ static struct mu_result all_tests()
     mu_run_test(test_encode_and_decode_compressed);
     mu_run_test(test_encode_and_decode_compressed2);
     mu_run_test(test_encode_and_decode_compressed_large);
+    mu_run_test(test_encode_and_decode_packed);
+    mu_run_test(test_decode_into_auto_resize);
+    mu_run_test(test_decode_with_allocator);
+    mu_run_test(test_encode_and_decode_shifted);
     mu_run_test(test_encode_and_decode_base64);
     mu_run_test(test_bounds_check_on_decode);
 
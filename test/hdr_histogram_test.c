@@ -8,9 +8,18 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <stddef.h>
+#include <string.h>
 
 #include <stdio.h>
 #include <hdr_histogram.h>
+#include <hdr_striped_histogram.h>
+#include <hdr_windowed_histogram.h>
+#include <hdr_decaying_histogram.h>
+#include <hdr_shared_histogram.h>
+#include <hdr_snapshot.h>
+#include <hdr_buffered_recorder.h>
+#include <hdr_percpu_recorder.h>
 
 #include "minunit.h"
 
@@ -475,6 +484,1488 @@ static char* test_linear_iter_buckets_correctly()
     return 0;
 }
 
+static char* test_record_value_atomic()
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* expected;
+    int i;
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &h);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &expected);
+
+    for (i = 0; i < 10000; i++)
+    {
+        hdr_record_value_atomic(h, 1000);
+        hdr_record_value(expected, 1000);
+    }
+
+    hdr_record_values_atomic(h, 0, 3);
+    hdr_record_values(expected, 0, 3);
+    hdr_record_corrected_value_atomic(h, 100000000, 10000);
+    hdr_record_corrected_value(expected, 100000000, 10000);
+
+    mu_assert("Should not record value", !hdr_record_value_atomic(h, INT64_C(3600) * 1000 * 1000 * 2));
+
+    mu_assert("Total count", compare_int64(h->total_count, expected->total_count));
+    mu_assert("Min value", compare_int64(hdr_min(h), hdr_min(expected)));
+    mu_assert("Max value", compare_int64(hdr_max(h), hdr_max(expected)));
+    mu_assert("Value at 99%",
+              compare_int64(hdr_value_at_percentile(h, 99.0), hdr_value_at_percentile(expected, 99.0)));
+
+    hdr_close(h);
+    hdr_close(expected);
+
+    return 0;
+}
+
+static char* test_striped_histogram()
+{
+    struct hdr_striped_histogram* s;
+    struct hdr_histogram* merged;
+    struct hdr_histogram* expected;
+    int64_t i;
+
+    mu_assert("Should reject zero stripes", EINVAL == hdr_striped_histogram_init(1, INT64_C(3600000000), 3, 0, &s));
+    mu_assert("Failed to allocate", 0 == hdr_striped_histogram_init(1, INT64_C(3600000000), 3, 4, &s));
+    hdr_init(1, INT64_C(3600000000), 3, &merged);
+    hdr_init(1, INT64_C(3600000000), 3, &expected);
+
+    mu_assert("Stripes should be cache line aligned",
+              ((uintptr_t) hdr_striped_histogram_stripe(s, 1) % 64) == 0 &&
+              ((uintptr_t) hdr_striped_histogram_stripe(s, 1)->counts % 64) == 0);
+    mu_assert("Stripe should wrap", hdr_striped_histogram_stripe(s, 5) == hdr_striped_histogram_stripe(s, 1));
+
+    for (i = 0; i < 10000; i++)
+    {
+        hdr_striped_histogram_record_value(s, (uint32_t) i, i * 10);
+        hdr_record_value(expected, i * 10);
+    }
+    hdr_striped_histogram_record_values(s, 7, 100000000, 3);
+    hdr_record_values(expected, 100000000, 3);
+
+    mu_assert("No values dropped", 0 == hdr_striped_histogram_merge(s, merged));
+    mu_assert("Total count", compare_int64(merged->total_count, expected->total_count));
+    mu_assert("Min value", compare_int64(hdr_min(merged), hdr_min(expected)));
+    mu_assert("Max value", compare_int64(hdr_max(merged), hdr_max(expected)));
+    mu_assert("Value at 90%",
+              compare_int64(hdr_value_at_percentile(merged, 90.0), hdr_value_at_percentile(expected, 90.0)));
+    mu_assert("Mean", compare_double(hdr_mean(merged), hdr_mean(expected), 0.001));
+
+    hdr_striped_histogram_reset(s);
+    hdr_reset(merged);
+    hdr_striped_histogram_merge(s, merged);
+    mu_assert("Total count after reset", compare_int64(merged->total_count, 0));
+
+    hdr_striped_histogram_close(s);
+    hdr_close(merged);
+    hdr_close(expected);
+
+    return 0;
+}
+
+static char* test_record_values_batch()
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* expected;
+    int64_t values[1000];
+    int64_t counts[1000];
+    int64_t expected_dropped = 0;
+    int i;
+
+    hdr_init(1, 1000000, 3, &h);
+    hdr_init(1, 1000000, 3, &expected);
+
+    for (i = 0; i < 1000; i++)
+    {
+        values[i] = (i * INT64_C(7919)) % 1200000 - 100;
+        counts[i] = i % 5;
+        if (!hdr_record_values(expected, values[i], counts[i]))
+        {
+            expected_dropped += counts[i];
+        }
+    }
+
+    mu_assert("Dropped with counts",
+              compare_int64(hdr_record_values_batch_with_counts(h, values, counts, 1000), expected_dropped));
+    mu_assert("Total count", compare_int64(h->total_count, expected->total_count));
+    mu_assert("Min value", compare_int64(hdr_min(h), hdr_min(expected)));
+    mu_assert("Max value", compare_int64(hdr_max(h), hdr_max(expected)));
+
+    hdr_reset(h);
+    hdr_reset(expected);
+    expected_dropped = 0;
+    for (i = 0; i < 1000; i++)
+    {
+        if (!hdr_record_value(expected, values[i]))
+        {
+            expected_dropped++;
+        }
+    }
+
+    mu_assert("Dropped", compare_int64(hdr_record_values_batch(h, values, 1000), expected_dropped));
+    mu_assert("Total count", compare_int64(h->total_count, expected->total_count));
+    mu_assert("Min value", compare_int64(hdr_min(h), hdr_min(expected)));
+    mu_assert("Max value", compare_int64(hdr_max(h), hdr_max(expected)));
+    mu_assert("Value at 50%",
+              compare_int64(hdr_value_at_percentile(h, 50.0), hdr_value_at_percentile(expected, 50.0)));
+
+    /* Batches that record nothing leave min and max alone. */
+    hdr_reset(h);
+    hdr_reset(expected);
+    values[0] = 100;
+    values[1] = 200;
+    values[2] = 300;
+    counts[0] = counts[1] = counts[2] = 0;
+    mu_assert("Nothing dropped", compare_int64(hdr_record_values_batch_with_counts(h, values, counts, 3), 0));
+    mu_assert("Zero counts max", compare_int64(hdr_max(h), 0));
+    mu_assert("Zero counts min", compare_int64(hdr_min(h), hdr_min(expected)));
+
+    values[0] = -1;
+    values[1] = INT64_C(2000000);
+    mu_assert("All dropped", compare_int64(hdr_record_values_batch(h, values, 2), 2));
+    mu_assert("Dropped max", compare_int64(hdr_max(h), 0));
+    mu_assert("Dropped min", compare_int64(hdr_min(h), hdr_min(expected)));
+    mu_assert("Should add", compare_int64(hdr_add(expected, h), 0));
+    mu_assert("Added max", compare_int64(hdr_max(expected), 0));
+
+    /* Batches of zeros record counts without moving min or max. */
+    hdr_reset(h);
+    hdr_reset(expected);
+    values[0] = values[1] = 0;
+    mu_assert("Zeros recorded", compare_int64(hdr_record_values_batch(h, values, 2), 0));
+    mu_assert("Zeros total", compare_int64(h->total_count, 2));
+    mu_assert("Zeros max", compare_int64(hdr_max(h), 0));
+    mu_assert("Zeros min", compare_int64(hdr_min(h), 0));
+    mu_assert("Should add zeros", compare_int64(hdr_add(expected, h), 0));
+    mu_assert("Added zeros max", compare_int64(hdr_max(expected), 0));
+    values[2] = 5;
+    mu_assert("Mixed recorded", compare_int64(hdr_record_values_batch(h, values, 3), 0));
+    mu_assert("Mixed max", compare_int64(hdr_max(h), 5));
+    mu_assert("Mixed min", compare_int64(hdr_min(h), 0));
+
+    hdr_close(h);
+    hdr_close(expected);
+
+    return 0;
+}
+
+static char* test_record_corrected_values_by_bucket()
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* expected;
+    struct hdr_iter iter;
+    const int64_t intervals[] = { 1, 3, 1000, 4095, 4096, 99999 };
+    int64_t missing_value;
+    int64_t value;
+    size_t i, j;
+
+    hdr_init(1, INT64_C(3600000000000), 3, &h);
+    hdr_init(1, INT64_C(3600000000000), 3, &expected);
+
+    for (i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++)
+    {
+        /* A long stall, then one between expected_interval and 2 * expected_interval. */
+        for (j = 0; j < 2; j++)
+        {
+            value = 0 == j ? 5000017 : intervals[i] + intervals[i] / 2;
+
+            hdr_reset(h);
+            hdr_reset(expected);
+
+            hdr_record_corrected_values(h, value, 3, intervals[i]);
+
+            hdr_record_values(expected, value, 3);
+            for (missing_value = value - intervals[i]; missing_value >= intervals[i]; missing_value -= intervals[i])
+            {
+                hdr_record_values(expected, missing_value, 3);
+            }
+
+            mu_assert("Total count", compare_int64(h->total_count, expected->total_count));
+            mu_assert("Min value", compare_int64(hdr_min(h), hdr_min(expected)));
+            mu_assert("Max value", compare_int64(hdr_max(h), hdr_max(expected)));
+
+            hdr_iter_init(&iter, expected);
+            while (hdr_iter_next(&iter))
+            {
+                mu_assert("Count at index", compare_int64(hdr_count_at_index(h, iter.counts_index), iter.count));
+            }
+        }
+    }
+
+    hdr_reset(h);
+    hdr_record_corrected_value(h, 150, 100);
+    mu_assert("Nothing missing", compare_int64(h->total_count, 1));
+    mu_assert("Min without missing values", hdr_values_are_equivalent(h, hdr_min(h), 150));
+
+    /* A 10 second stall at a 1us expected interval, in nanoseconds. */
+    hdr_reset(h);
+    hdr_record_corrected_value(h, INT64_C(10000000000), 1000);
+    mu_assert("Total count for large stall", compare_int64(h->total_count, INT64_C(10000000)));
+    mu_assert("Min for large stall", compare_int64(hdr_min(h), 1000));
+
+    hdr_close(h);
+    hdr_close(expected);
+
+    return 0;
+}
+
+static char* test_add()
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* from;
+    struct hdr_histogram* small;
+    struct hdr_histogram* expected;
+    struct hdr_iter iter;
+    int64_t i;
+
+    hdr_init(1, INT64_C(3600000000), 3, &h);
+    hdr_init(1, INT64_C(36000000000), 3, &from);
+    hdr_init(1, 10000, 3, &small);
+    hdr_init(1, INT64_C(3600000000), 3, &expected);
+
+    for (i = 0; i < 1000; i++)
+    {
+        hdr_record_value(h, i * 3 + 5);
+        hdr_record_value(expected, i * 3 + 5);
+        hdr_record_values(from, i * 1000, 2);
+        hdr_record_values(expected, i * 1000, 2);
+    }
+
+    mu_assert("Should not drop values", compare_int64(hdr_add(h, from), 0));
+    mu_assert("Total count", compare_int64(h->total_count, expected->total_count));
+    mu_assert("Min value", compare_int64(hdr_min(h), hdr_min(expected)));
+    mu_assert("Max value", compare_int64(hdr_max(h), hdr_max(expected)));
+
+    hdr_iter_init(&iter, expected);
+    while (hdr_iter_next(&iter))
+    {
+        mu_assert("Count at index", compare_int64(hdr_count_at_index(h, iter.counts_index), iter.count));
+    }
+
+    mu_assert("Should drop values out of range", compare_int64(hdr_add(small, from), 1966));
+    mu_assert("Small total count", compare_int64(small->total_count, 34));
+
+    hdr_close(h);
+    hdr_close(from);
+    hdr_close(small);
+    hdr_close(expected);
+
+    return 0;
+}
+
+static char* test_cumulative_index()
+{
+    struct hdr_cumulative_index index;
+    const double percentiles[] = { 0.0, 30.0, 50.0, 75.0, 90.0, 99.0, 99.9, 99.999, 100.0 };
+    int64_t values[9];
+    size_t i;
+
+    load_histograms();
+
+    mu_assert("Failed to init index", 0 == hdr_cumulative_index_init(&index, cor_histogram));
+
+    for (i = 0; i < 9; i++)
+    {
+        mu_assert("Value at percentile",
+                  compare_int64(
+                      hdr_cumulative_index_value_at_percentile(&index, percentiles[i]),
+                      hdr_value_at_percentile(cor_histogram, percentiles[i])));
+    }
+
+    mu_assert("Batch query", 0 == hdr_cumulative_index_values_at_percentiles(&index, percentiles, values, 9));
+    for (i = 0; i < 9; i++)
+    {
+        mu_assert("Batch value at percentile",
+                  compare_int64(values[i], hdr_value_at_percentile(cor_histogram, percentiles[i])));
+    }
+
+    mu_assert("Count between all", compare_int64(hdr_cumulative_index_count_between(&index, 0, INT64_MAX), 20000));
+    mu_assert("Count between 1000", compare_int64(hdr_cumulative_index_count_between(&index, 1000, 1000), 10000));
+    mu_assert("Count between above 1000", compare_int64(hdr_cumulative_index_count_between(&index, 1001, 100000000), 10000));
+    mu_assert("Count between empty", compare_int64(hdr_cumulative_index_count_between(&index, 2, 999), 0));
+
+    hdr_record_values(cor_histogram, 500, 30000);
+    mu_assert("Should refresh when stale",
+              compare_int64(
+                  hdr_cumulative_index_value_at_percentile(&index, 50.0),
+                  hdr_value_at_percentile(cor_histogram, 50.0)));
+
+    hdr_reset(cor_histogram);
+    mu_assert("Empty histogram", compare_int64(hdr_cumulative_index_value_at_percentile(&index, 50.0), 0));
+
+    hdr_cumulative_index_destroy(&index);
+
+    return 0;
+}
+
+static char* test_value_at_percentiles()
+{
+    const double percentiles[] = { 0.0, 30.0, 50.0, 50.0, 75.0, 90.0, 99.0, 99.999, 100.0 };
+    const double unordered[] = { 50.0, 30.0 };
+    int64_t values[9];
+    size_t i;
+
+    load_histograms();
+
+    mu_assert("Should succeed", 0 == hdr_value_at_percentiles(cor_histogram, percentiles, values, 9));
+    for (i = 0; i < 9; i++)
+    {
+        mu_assert("Value at percentile",
+                  compare_int64(values[i], hdr_value_at_percentile(cor_histogram, percentiles[i])));
+    }
+
+    mu_assert("Should reject unordered percentiles",
+              EINVAL == hdr_value_at_percentiles(cor_histogram, unordered, values, 2));
+
+    hdr_reset(cor_histogram);
+    mu_assert("Should succeed when empty", 0 == hdr_value_at_percentiles(cor_histogram, percentiles, values, 9));
+    mu_assert("Empty histogram", compare_int64(values[8], 0));
+
+    return 0;
+}
+
+static char* test_running_moments()
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* expected;
+    struct hdr_histogram* other;
+    int64_t i;
+
+    hdr_init(1, INT64_C(3600000000), 3, &h);
+    hdr_init(1, INT64_C(3600000000), 3, &expected);
+    hdr_init(1, INT64_C(3600000000), 3, &other);
+
+    for (i = 1; i < 1000; i++)
+    {
+        hdr_record_value(h, i * 17);
+        hdr_record_value(expected, i * 17);
+    }
+
+    /* Enabling on a populated histogram computes the moments from the counts. */
+    hdr_set_running_moments(h, true);
+    mu_assert("Mean after enable", compare_values(hdr_mean(h), hdr_mean(expected), 0.0000001));
+    mu_assert("Stddev after enable", compare_values(hdr_stddev(h), hdr_stddev(expected), 0.0000001));
+
+    hdr_record_values(h, 5000, 100);
+    hdr_record_values(expected, 5000, 100);
+    hdr_record_value_atomic(h, 123456);
+    hdr_record_value_atomic(expected, 123456);
+    hdr_record_corrected_value(h, 1000000, 30000);
+    hdr_record_corrected_value(expected, 1000000, 30000);
+
+    for (i = 0; i < 100; i++)
+    {
+        hdr_record_value(other, i * 31);
+    }
+    hdr_add(h, other);
+    hdr_add(expected, other);
+
+    mu_assert("Mean", compare_values(hdr_mean(h), hdr_mean(expected), 0.0000001));
+    mu_assert("Stddev", compare_values(hdr_stddev(h), hdr_stddev(expected), 0.0000001));
+
+    hdr_reset(h);
+    hdr_record_value(h, 1000);
+    mu_assert("Mean after reset", compare_values(hdr_mean(h), 1000.0, 0.001));
+    mu_assert("Stddev after reset", compare_double(hdr_stddev(h), 0.0, 0.0000001));
+
+    hdr_close(h);
+    hdr_close(expected);
+    hdr_close(other);
+
+    return 0;
+}
+
+static char* test_packed_histogram()
+{
+    struct hdr_histogram* packed;
+    struct hdr_histogram* expected;
+    struct hdr_histogram* merged;
+    struct hdr_iter iter;
+    const int64_t batch[] = { 7, 7, 70000, 7000000 };
+    size_t empty_size;
+    int64_t i;
+
+    mu_assert("Failed to init", 0 == hdr_init_packed(1, INT64_C(3600000000), 3, &packed));
+    hdr_init(1, INT64_C(3600000000), 3, &expected);
+    hdr_init(1, INT64_C(3600000000), 3, &merged);
+
+    empty_size = hdr_get_memory_size(packed);
+    mu_assert("Should be smaller than dense", empty_size < hdr_get_memory_size(expected) / 8);
+
+    for (i = 1; i <= 10000; i++)
+    {
+        hdr_record_value(packed, i % 100 + 1000);
+        hdr_record_value(expected, i % 100 + 1000);
+    }
+    hdr_record_values(packed, 2000, 300);
+    hdr_record_values(expected, 2000, 300);
+    hdr_record_values(packed, 3000, 70000);
+    hdr_record_values(expected, 3000, 70000);
+    hdr_record_values(packed, 4000, INT64_C(5000000000));
+    hdr_record_values(expected, 4000, INT64_C(5000000000));
+    hdr_record_corrected_value(packed, 100000000, 10000);
+    hdr_record_corrected_value(expected, 100000000, 10000);
+
+    mu_assert("Should not record atomically", !hdr_record_value_atomic(packed, 1000));
+    mu_assert("Total count", compare_int64(packed->total_count, expected->total_count));
+    mu_assert("Min", compare_int64(hdr_min(packed), hdr_min(expected)));
+    mu_assert("Max", compare_int64(hdr_max(packed), hdr_max(expected)));
+    mu_assert("Widened count", compare_int64(hdr_count_at_value(packed, 4000), INT64_C(5000000000)));
+    mu_assert("Mean", compare_values(hdr_mean(packed), hdr_mean(expected), 0.0000001));
+    mu_assert("Stddev", compare_values(hdr_stddev(packed), hdr_stddev(expected), 0.0000001));
+    mu_assert("p50", compare_int64(hdr_value_at_percentile(packed, 50.0), hdr_value_at_percentile(expected, 50.0)));
+    mu_assert("p99.99", compare_int64(hdr_value_at_percentile(packed, 99.99), hdr_value_at_percentile(expected, 99.99)));
+    mu_assert("Still smaller than dense", hdr_get_memory_size(packed) < hdr_get_memory_size(expected) / 4);
+
+    hdr_iter_recorded_init(&iter, packed);
+    while (hdr_iter_next(&iter))
+    {
+        mu_assert("Recorded count", compare_int64(iter.count, hdr_count_at_value(expected, iter.value)));
+    }
+
+    mu_assert("Add from packed", compare_int64(hdr_add(merged, packed), 0));
+    mu_assert("Add from packed total", compare_int64(merged->total_count, expected->total_count));
+    hdr_reset(merged);
+    hdr_reset(packed);
+    mu_assert("Reset total", compare_int64(packed->total_count, 0));
+    mu_assert("Reset count", compare_int64(hdr_count_at_value(packed, 4000), 0));
+
+    mu_assert("Add into packed", compare_int64(hdr_add(packed, expected), 0));
+    mu_assert("Add into packed p99", compare_int64(hdr_value_at_percentile(packed, 99.0), hdr_value_at_percentile(expected, 99.0)));
+    mu_assert("Batch into packed", compare_int64(hdr_record_values_batch(packed, batch, 4), 0));
+    mu_assert("Batch into packed count", compare_int64(hdr_count_at_value(packed, 7), 2));
+
+    hdr_close(packed);
+    hdr_close(expected);
+    hdr_close(merged);
+
+    return 0;
+}
+
+static char* test_paged_histogram()
+{
+    struct hdr_histogram* paged;
+    struct hdr_histogram* expected;
+    struct hdr_iter iter;
+    size_t empty_size;
+    int64_t i;
+    int steps;
+
+    mu_assert("Failed to init", 0 == hdr_init_paged(1, INT64_C(3600000000000), 5, &paged));
+    hdr_init(1, INT64_C(3600000000000), 5, &expected);
+
+    empty_size = hdr_get_memory_size(paged);
+    mu_assert("Should be smaller than dense", empty_size < hdr_get_memory_size(expected) / 64);
+
+    for (i = 1; i <= 10000; i++)
+    {
+        hdr_record_value(paged, i * 13);
+        hdr_record_value(expected, i * 13);
+    }
+    hdr_record_values(paged, INT64_C(5000000000), 3);
+    hdr_record_values(expected, INT64_C(5000000000), 3);
+
+    mu_assert("Should not record atomically", !hdr_record_value_atomic(paged, 1000));
+    mu_assert("Total count", compare_int64(paged->total_count, expected->total_count));
+    mu_assert("Min", compare_int64(hdr_min(paged), hdr_min(expected)));
+    mu_assert("Max", compare_int64(hdr_max(paged), hdr_max(expected)));
+    mu_assert("Mean", compare_values(hdr_mean(paged), hdr_mean(expected), 0.0000001));
+    mu_assert("p50", compare_int64(hdr_value_at_percentile(paged, 50.0), hdr_value_at_percentile(expected, 50.0)));
+    mu_assert("p99.99", compare_int64(hdr_value_at_percentile(paged, 99.99), hdr_value_at_percentile(expected, 99.99)));
+    mu_assert("Only touched pages", hdr_get_memory_size(paged) < hdr_get_memory_size(expected) / 4);
+
+    mu_assert("Should shift", 0 == hdr_shift_values_left(paged, 3));
+    mu_assert("Should shift expected", 0 == hdr_shift_values_left(expected, 3));
+
+    steps = 0;
+    hdr_iter_recorded_init(&iter, paged);
+    while (hdr_iter_next(&iter))
+    {
+        mu_assert("Recorded count", compare_int64(iter.count, hdr_count_at_value(expected, iter.value)));
+        steps++;
+    }
+    mu_assert("Recorded steps", compare_int64(steps, 10001));
+    mu_assert("Shifted p90", compare_int64(hdr_value_at_percentile(paged, 90.0), hdr_value_at_percentile(expected, 90.0)));
+
+    hdr_reset(paged);
+    mu_assert("Reset total", compare_int64(paged->total_count, 0));
+    mu_assert("Reset count", compare_int64(hdr_count_at_value(paged, 13), 0));
+    mu_assert("Empty percentile", compare_int64(hdr_value_at_percentile(paged, 50.0), 0));
+
+    hdr_close(paged);
+    hdr_close(expected);
+
+    return 0;
+}
+
+static bool all_counts_zero(const struct hdr_histogram* h)
+{
+    int32_t i;
+    for (i = 0; i < h->counts_len; i++)
+    {
+        if (0 != hdr_count_at_index(h, i))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static char* test_reset_touched_range()
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* sum;
+    struct hdr_iter iter;
+    int64_t i;
+
+    hdr_init(1, INT64_C(3600000000), 3, &h);
+    hdr_init(1, INT64_C(3600000000), 3, &sum);
+
+    for (i = 0; i < 1000; i++)
+    {
+        hdr_record_value(h, 500000 + i * 100);
+    }
+    hdr_record_values(h, 0, 7);
+
+    hdr_iter_recorded_init(&iter, h);
+    mu_assert("Should iterate zero value", hdr_iter_next(&iter));
+    mu_assert("Zero value count", compare_int64(iter.count, 7));
+    mu_assert("Should skip to min", hdr_iter_next(&iter));
+    mu_assert("First recorded value", hdr_values_are_equivalent(h, iter.value, 500000));
+
+    mu_assert("Should add", compare_int64(hdr_add(sum, h), 0));
+    mu_assert("Added total", compare_int64(sum->total_count, 1007));
+    mu_assert("Added zeros", compare_int64(hdr_count_at_value(sum, 0), 7));
+    mu_assert("Added p50", compare_int64(hdr_value_at_percentile(sum, 50.0), hdr_value_at_percentile(h, 50.0)));
+
+    hdr_reset(h);
+    mu_assert("Reset should clear counts", all_counts_zero(h));
+
+    /* A shifted histogram's touched range wraps around the end of the counts array. */
+    for (i = 1; i < 1000; i++)
+    {
+        hdr_record_value(h, i * 1000);
+    }
+    hdr_record_value(h, 0);
+    mu_assert("Should shift", 0 == hdr_shift_values_left(h, 4));
+    mu_assert("Shifted count", compare_int64(hdr_count_at_value(h, INT64_C(1000) << 4), 1));
+
+    hdr_reset(h);
+    mu_assert("Reset should clear shifted counts", all_counts_zero(h));
+
+    hdr_close(h);
+    hdr_close(sum);
+
+    return 0;
+}
+
+static bool iterators_match(struct hdr_iter* a, struct hdr_iter* b)
+{
+    bool has_a, has_b;
+
+    do
+    {
+        has_a = hdr_iter_next(a);
+        has_b = hdr_iter_next(b);
+
+        if (has_a != has_b)
+        {
+            return false;
+        }
+
+        if (has_a &&
+            (a->value != b->value || a->count != b->count || a->cumulative_count != b->cumulative_count ||
+             a->value_iterated_to != b->value_iterated_to))
+        {
+            printf("%" PRId64 " != %" PRId64 "\n", a->value_iterated_to, b->value_iterated_to);
+            return false;
+        }
+    }
+    while (has_a);
+
+    return true;
+}
+
+static char* test_occupancy_iteration()
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* plain;
+    struct hdr_histogram* sum;
+    struct hdr_histogram* late;
+    struct hdr_histogram* packed;
+    struct hdr_iter a, b;
+    int64_t i;
+
+    hdr_init(1, INT64_C(3600000000), 3, &h);
+    hdr_init_aligned(1, INT64_C(3600000000), 3, false, &plain);
+    hdr_init_aligned(1, INT64_C(3600000000), 3, false, &late);
+    hdr_init(1, INT64_C(3600000000), 3, &sum);
+    hdr_init_packed(1, INT64_C(3600000000), 3, &packed);
+
+    mu_assert("Off by default", !h->track_occupancy);
+    mu_assert("Should track", 0 == hdr_set_occupancy_tracking(h, true));
+    mu_assert("Should track sum", 0 == hdr_set_occupancy_tracking(sum, true));
+    mu_assert("Should not track packed", EINVAL == hdr_set_occupancy_tracking(packed, true));
+
+    for (i = 1; i < 200; i++)
+    {
+        hdr_record_value(h, i * i * i * 13);
+        hdr_record_value(plain, i * i * i * 13);
+        hdr_record_value(late, i * i * i * 13);
+        hdr_record_value_atomic(h, 20000 + i);
+        hdr_record_value(plain, 20000 + i);
+        hdr_record_value(late, 20000 + i);
+    }
+    hdr_record_value(h, 0);
+    hdr_record_value(plain, 0);
+    hdr_record_value(late, 0);
+
+    hdr_iter_recorded_init(&a, h);
+    hdr_iter_recorded_init(&b, plain);
+    mu_assert("Recorded", iterators_match(&a, &b));
+
+    /* Enabled after recording, the counts move out of the aligned block. */
+    mu_assert("Should track late", 0 == hdr_set_occupancy_tracking(late, true));
+    hdr_iter_recorded_init(&a, late);
+    hdr_iter_recorded_init(&b, plain);
+    mu_assert("Recorded late", iterators_match(&a, &b));
+    hdr_iter_percentile_init(&a, h, 5);
+    hdr_iter_percentile_init(&b, plain, 5);
+    mu_assert("Percentiles", iterators_match(&a, &b));
+    hdr_iter_linear_init(&a, h, 100000);
+    hdr_iter_linear_init(&b, plain, 100000);
+    mu_assert("Linear", iterators_match(&a, &b));
+    hdr_iter_log_init(&a, h, 10, 2.0);
+    hdr_iter_log_init(&b, plain, 10, 2.0);
+    mu_assert("Log", iterators_match(&a, &b));
+
+    mu_assert("Should add", compare_int64(hdr_add(sum, h), 0));
+    hdr_iter_recorded_init(&a, sum);
+    hdr_iter_recorded_init(&b, plain);
+    mu_assert("Added", iterators_match(&a, &b));
+
+    mu_assert("Should shift", 0 == hdr_shift_values_left(h, 2));
+    mu_assert("Should shift plain", 0 == hdr_shift_values_left(plain, 2));
+    hdr_iter_recorded_init(&a, h);
+    hdr_iter_recorded_init(&b, plain);
+    mu_assert("Shifted", iterators_match(&a, &b));
+
+    hdr_reset(h);
+    hdr_reset(plain);
+    hdr_record_value(h, 12345);
+    hdr_record_value(plain, 12345);
+    hdr_iter_linear_init(&a, h, 1000);
+    hdr_iter_linear_init(&b, plain, 1000);
+    mu_assert("After reset", iterators_match(&a, &b));
+
+    hdr_close(h);
+    hdr_close(plain);
+    hdr_close(sum);
+    hdr_close(late);
+    hdr_close(packed);
+
+    return 0;
+}
+
+static char* test_subtract()
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* part;
+    struct hdr_histogram* expected;
+    struct hdr_histogram* other_range;
+    int64_t i;
+
+    hdr_init(1, INT64_C(3600000000), 3, &h);
+    hdr_init(1, INT64_C(3600000000), 3, &part);
+    hdr_init(1, INT64_C(3600000000), 3, &expected);
+    hdr_init(1, INT64_C(100000), 2, &other_range);
+    hdr_set_running_moments(h, true);
+    hdr_set_running_moments(part, true);
+    hdr_set_running_moments(expected, true);
+
+    for (i = 1; i <= 1000; i++)
+    {
+        hdr_record_value(h, i * 10);
+        hdr_record_value(expected, i * 10);
+        hdr_record_value(h, i * 100000);
+        hdr_record_value(part, i * 100000);
+    }
+
+    mu_assert("Should subtract", 0 == hdr_subtract(h, part));
+    mu_assert("Total count", compare_int64(h->total_count, expected->total_count));
+    mu_assert("Min", compare_int64(hdr_min(h), hdr_min(expected)));
+    mu_assert("Max", compare_int64(hdr_max(h), hdr_max(expected)));
+    mu_assert("p99", compare_int64(hdr_value_at_percentile(h, 99.0), hdr_value_at_percentile(expected, 99.0)));
+    mu_assert("Mean", compare_values(hdr_mean(h), hdr_mean(expected), 0.000001));
+
+    mu_assert("Should reject negative counts", EINVAL == hdr_subtract(h, part));
+    mu_assert("Rejected total count", compare_int64(h->total_count, expected->total_count));
+    mu_assert("Rejected p99", compare_int64(hdr_value_at_percentile(h, 99.0), hdr_value_at_percentile(expected, 99.0)));
+
+    hdr_record_value(other_range, 4096);
+    hdr_record_value(h, 4096);
+    mu_assert("Should subtract a different layout", 0 == hdr_subtract(h, other_range));
+    mu_assert("Different layout total", compare_int64(h->total_count, expected->total_count));
+
+    hdr_reset(h);
+    mu_assert("Should subtract from empty", EINVAL == hdr_subtract(h, part));
+
+    hdr_close(h);
+    hdr_close(part);
+    hdr_close(expected);
+    hdr_close(other_range);
+
+    return 0;
+}
+
+static char* test_windowed_histogram()
+{
+    struct hdr_windowed_histogram w;
+    const struct hdr_histogram* aggregate;
+    int64_t i;
+    int32_t slot;
+
+    mu_assert("Should reject no slots", EINVAL == hdr_windowed_histogram_init(&w, 1, 1000000, 3, 0));
+    mu_assert("Should init", 0 == hdr_windowed_histogram_init(&w, 1, 1000000, 3, 3));
+    aggregate = hdr_windowed_histogram_aggregate(&w);
+
+    /* Slot n records n * 1000 values of n * 1000. */
+    for (slot = 1; slot <= 5; slot++)
+    {
+        for (i = 0; i < slot * 1000; i++)
+        {
+            hdr_windowed_histogram_record_value(&w, slot * 1000);
+        }
+        mu_assert("Should rotate", 0 == hdr_windowed_histogram_rotate(&w));
+    }
+
+    mu_assert("Window count", compare_int64(aggregate->total_count, 3000 + 4000 + 5000));
+    mu_assert("Window min", hdr_values_are_equivalent(aggregate, hdr_min(aggregate), 3000));
+    mu_assert("Window max", hdr_values_are_equivalent(aggregate, hdr_max(aggregate), 5000));
+    mu_assert("Expired values", compare_int64(hdr_count_at_value(aggregate, 2000), 0));
+    mu_assert("Window p50", hdr_values_are_equivalent(aggregate, hdr_value_at_percentile(aggregate, 50.0), 4000));
+
+    hdr_windowed_histogram_record_value_atomic(&w, 6000);
+    for (slot = 0; slot < 3; slot++)
+    {
+        mu_assert("Should rotate", 0 == hdr_windowed_histogram_rotate(&w));
+    }
+    mu_assert("Only the last value", compare_int64(aggregate->total_count, 1));
+    mu_assert("Last value", hdr_values_are_equivalent(aggregate, hdr_max(aggregate), 6000));
+
+    mu_assert("Should rotate", 0 == hdr_windowed_histogram_rotate(&w));
+    mu_assert("Empty window", compare_int64(aggregate->total_count, 0));
+    mu_assert("Empty max", compare_int64(hdr_max(aggregate), 0));
+
+    hdr_windowed_histogram_destroy(&w);
+
+    return 0;
+}
+
+static char* test_decaying_histogram()
+{
+    struct hdr_decaying_histogram* h;
+    int i;
+
+    mu_assert("Should reject zero half life", EINVAL == hdr_decaying_init(1, 1000000, 3, 0.0, 0, &h));
+    mu_assert("Should init", 0 == hdr_decaying_init(1, 1000000, 3, 1000.0, 0, &h));
+
+    for (i = 0; i < 1000; i++)
+    {
+        mu_assert("Should record", hdr_decaying_record_value(h, 100, 0));
+    }
+    mu_assert("Should reject out of range", !hdr_decaying_record_value(h, INT64_C(10000000), 0));
+    mu_assert("Count at landmark", compare_values(hdr_decaying_count(h, 0), 1000.0, 0.000001));
+    mu_assert("Count after a half life", compare_values(hdr_decaying_count(h, 1000), 500.0, 0.000001));
+
+    /* Ten half lives later a new value outweighs an old one 1024 times. */
+    for (i = 0; i < 1000; i++)
+    {
+        hdr_decaying_record_value(h, 900, 10000);
+    }
+    mu_assert("Landmark kept", compare_int64(h->landmark, 0));
+    mu_assert("Old values still present", compare_int64(hdr_min(&h->values), 100));
+    mu_assert("p50 is recent", compare_int64(hdr_decaying_value_at_percentile(h, 50.0), 900));
+    mu_assert("p0.05 is old", compare_int64(hdr_decaying_value_at_percentile(h, 0.05), 100));
+    mu_assert("Decayed count",
+              compare_values(hdr_decaying_count(h, 10000), 1000.0 + 1000.0 / 1024.0, 0.000001));
+
+    /* Twenty half lives on, recording rescales and the old values decay away. */
+    mu_assert("Should record", hdr_decaying_record_value(h, 500, 20000));
+    mu_assert("Landmark moved", compare_int64(h->landmark, 20000));
+    mu_assert("Old values dropped", compare_int64(hdr_count_at_value(&h->values, 100), 0));
+    mu_assert("Min after rescale", compare_int64(hdr_min(&h->values), 500));
+    mu_assert("Max after rescale", compare_int64(hdr_max(&h->values), 900));
+    mu_assert("Count after rescale", compare_values(hdr_decaying_count(h, 20000), 1.0 + 1000.0 / 1024.0, 0.01));
+
+    hdr_decaying_rescale(h, 100000);
+    mu_assert("Everything decayed", compare_int64(h->values.total_count, 0));
+    mu_assert("Empty max", compare_int64(hdr_max(&h->values), 0));
+
+    hdr_decaying_record_value(h, 700, 100000);
+    hdr_decaying_reset(h, 200000);
+    mu_assert("Reset", compare_int64(h->values.total_count, 0));
+    mu_assert("Reset landmark", compare_int64(h->landmark, 200000));
+
+    /* Rescaling works on the normalised counts of shifted values. */
+    hdr_decaying_record_value(h, 100, 200000);
+    hdr_decaying_record_value(h, 1000, 200000);
+    mu_assert("Should shift", 0 == hdr_shift_values_left(&h->values, 1));
+    hdr_decaying_rescale(h, 201000);
+    mu_assert("Shifted total", compare_int64(h->values.total_count, 64));
+    mu_assert("Shifted low count", compare_int64(hdr_count_at_value(&h->values, 200), 32));
+    mu_assert("Shifted high count", compare_int64(hdr_count_at_value(&h->values, 2000), 32));
+    mu_assert("Shifted min", compare_int64(hdr_min(&h->values), 200));
+    mu_assert("Shifted max", hdr_values_are_equivalent(&h->values, hdr_max(&h->values), 2000));
+
+    /* Times before the landmark don't inflate the counts, and weights that overflow are rejected. */
+    hdr_decaying_reset(h, 300000);
+    mu_assert("Should record before landmark", hdr_decaying_record_value(h, 100, 299000));
+    mu_assert("Weighted at landmark", compare_int64(h->values.total_count, 64));
+    hdr_decaying_rescale(h, 200000);
+    mu_assert("Rescale before landmark", compare_int64(h->values.total_count, 64));
+    mu_assert("Landmark not moved back", compare_int64(h->landmark, 300000));
+    mu_assert("Count before landmark", compare_values(hdr_decaying_count(h, 200000), 1.0, 0.000001));
+    mu_assert("Should reject overflowing count", !hdr_decaying_record_values(h, 100, INT64_C(1) << 58, 300000));
+    mu_assert("Should reject overflowing weight", !hdr_decaying_record_values(h, 100, INT64_C(1) << 50, 311000));
+    mu_assert("Overflow not recorded", compare_int64(h->values.total_count, 64));
+
+    hdr_decaying_close(h);
+
+    return 0;
+}
+
+static char* test_shared_histogram()
+{
+    const char* path = "hdr_shared_histogram_test.hdr";
+    struct hdr_shared_histogram* writer;
+    struct hdr_shared_histogram* reader;
+    struct hdr_histogram* recorded;
+    struct hdr_histogram* attached;
+    FILE* f;
+    int64_t i;
+    int r;
+
+    r = hdr_shared_create(path, 1, INT64_C(3600000000), 3, &writer);
+    if (ENOSYS == r)
+    {
+        return 0;
+    }
+    mu_assert("Should create", 0 == r);
+    recorded = hdr_shared_histogram_get(writer);
+
+    for (i = 1; i <= 10000; i++)
+    {
+        hdr_record_value_atomic(recorded, i * 100);
+    }
+
+    mu_assert("Should attach", 0 == hdr_shared_attach(path, &reader));
+    attached = hdr_shared_histogram_get(reader);
+    mu_assert("Header", compare_int64(reader->header->counts_len, recorded->counts_len));
+    mu_assert("Total count", compare_int64(attached->total_count, 10000));
+    mu_assert("Min", compare_int64(hdr_min(attached), hdr_min(recorded)));
+    mu_assert("Max", compare_int64(hdr_max(attached), hdr_max(recorded)));
+    mu_assert("p99", compare_int64(hdr_value_at_percentile(attached, 99.0), hdr_value_at_percentile(recorded, 99.0)));
+
+    hdr_record_value_atomic(recorded, INT64_C(3000000000));
+    mu_assert("Not refreshed", compare_int64(attached->total_count, 10000));
+    mu_assert("Counts are shared", compare_int64(hdr_count_at_value(attached, INT64_C(3000000000)), 1));
+    hdr_shared_refresh(reader);
+    mu_assert("Refreshed count", compare_int64(attached->total_count, 10001));
+    mu_assert("Refreshed max", compare_int64(hdr_max(attached), hdr_max(recorded)));
+
+    hdr_shared_close(reader);
+    hdr_shared_close(writer);
+
+    f = fopen(path, "w");
+    mu_assert("Could not open file", f != NULL);
+    for (i = 0; i < 100; i++)
+    {
+        fputs("not a histogram", f);
+    }
+    fclose(f);
+    mu_assert("Should reject other files", EINVAL == hdr_shared_attach(path, &reader));
+    mu_assert("Should fail for missing files", ENOENT == hdr_shared_attach("no/such/histogram.hdr", &reader));
+
+    remove(path);
+
+    return 0;
+}
+
+static char* test_persistent_histogram()
+{
+    const char* path = "hdr_persistent_histogram_test.hdr";
+    struct hdr_shared_histogram* s;
+    struct hdr_histogram* h;
+    FILE* f;
+    int64_t i;
+    int r;
+
+    remove(path);
+    r = hdr_shared_open(path, 1, INT64_C(3600000000), 3, &s);
+    if (ENOSYS == r)
+    {
+        return 0;
+    }
+    mu_assert("Should create", 0 == r);
+
+    h = hdr_shared_histogram_get(s);
+    for (i = 1; i <= 1000; i++)
+    {
+        hdr_record_value_atomic(h, i * 1000);
+    }
+    mu_assert("Should sync", 0 == hdr_shared_sync(s, false));
+    mu_assert("Should sync async", 0 == hdr_shared_sync(s, true));
+    hdr_shared_close(s);
+
+    mu_assert("Should reopen", 0 == hdr_shared_open(path, 1, INT64_C(3600000000), 3, &s));
+    h = hdr_shared_histogram_get(s);
+    mu_assert("Kept count", compare_int64(h->total_count, 1000));
+    mu_assert("Kept max", hdr_values_are_equivalent(h, hdr_max(h), 1000000));
+    hdr_record_value_atomic(h, 5);
+    mu_assert("Continues recording", compare_int64(h->total_count, 1001));
+    mu_assert("New min", compare_int64(hdr_min(h), 5));
+    hdr_shared_close(s);
+
+    mu_assert("Should reject other configs", EINVAL == hdr_shared_open(path, 1, INT64_C(3600000000), 2, &s));
+
+    f = fopen(path, "r+b");
+    mu_assert("Could not open file", f != NULL);
+    fseek(f, (long) offsetof(struct hdr_shared_header, highest_trackable_value), SEEK_SET);
+    fputc(0x7f, f);
+    fclose(f);
+    mu_assert("Should reject corrupt header", EINVAL == hdr_shared_open(path, 1, INT64_C(3600000000), 3, &s));
+    mu_assert("Should reject corrupt header on attach", EINVAL == hdr_shared_attach(path, &s));
+
+    remove(path);
+
+    return 0;
+}
+
+static void reverse_bytes(uint8_t* p, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n / 2; i++)
+    {
+        uint8_t b = p[i];
+        p[i] = p[n - 1 - i];
+        p[n - 1 - i] = b;
+    }
+}
+
+static char* test_snapshot()
+{
+    static const size_t header_fields[] = { 4, 4, 4, 4, 8, 8, 4, 4, 8, 8, 8 };
+    struct hdr_histogram* h;
+    struct hdr_histogram* loaded = NULL;
+    struct hdr_histogram* rejected = NULL;
+    struct hdr_histogram* packed;
+    struct hdr_snapshot_header header;
+    uint8_t* buffer;
+    size_t size, offset, i;
+    FILE* f;
+
+    hdr_init(1, INT64_C(3600000000), 3, &h);
+    hdr_init_packed(1, INT64_C(3600000000), 3, &packed);
+    for (i = 1; i <= 10000; i++)
+    {
+        hdr_record_value(h, (int64_t) i * 1000);
+    }
+
+    size = hdr_snapshot_size(h);
+    buffer = malloc(size);
+    f = tmpfile();
+    mu_assert("Could not open file", f != NULL);
+    mu_assert("Should write", 0 == hdr_snapshot_write(h, fileno(f)));
+    rewind(f);
+    mu_assert("Should read back", size == fread(buffer, 1, size, f));
+    fclose(f);
+
+    mu_assert("Should load", 0 == hdr_snapshot_load(buffer, size, &loaded));
+    mu_assert("Total count", compare_int64(loaded->total_count, h->total_count));
+    mu_assert("Min", compare_int64(hdr_min(loaded), hdr_min(h)));
+    mu_assert("Max", compare_int64(hdr_max(loaded), hdr_max(h)));
+    mu_assert("p99", compare_int64(hdr_value_at_percentile(loaded, 99.0), hdr_value_at_percentile(h, 99.0)));
+
+    hdr_record_value(loaded, 5);
+    mu_assert("Should load into", 0 == hdr_snapshot_load_into(loaded, buffer, size));
+    mu_assert("Replaces counts", compare_int64(hdr_count_at_value(loaded, 5), 0));
+    mu_assert("Should not load into packed", EINVAL == hdr_snapshot_load_into(packed, buffer, size));
+    mu_assert("Should reject packed", EINVAL == hdr_snapshot_header_init(packed, &header));
+    mu_assert("Should reject truncated", EINVAL == hdr_snapshot_load_into(loaded, buffer, size - 8));
+
+    memcpy(&header, buffer, sizeof(header));
+    header.normalizing_index_offset = loaded->counts_len;
+    memcpy(buffer, &header, sizeof(header));
+    mu_assert("Should reject offset past the end", EINVAL == hdr_snapshot_load_into(loaded, buffer, size));
+    header.normalizing_index_offset = -loaded->counts_len;
+    memcpy(buffer, &header, sizeof(header));
+    mu_assert("Should reject offset before the start", EINVAL == hdr_snapshot_load(buffer, size, &rejected));
+    header.normalizing_index_offset = 0;
+    memcpy(buffer, &header, sizeof(header));
+
+    /* The same snapshot as written on a machine with the other byte order. */
+    for (i = 0, offset = 0; i < sizeof(header_fields) / sizeof(header_fields[0]); i++)
+    {
+        reverse_bytes(buffer + offset, header_fields[i]);
+        offset += header_fields[i];
+    }
+    for (; offset < size; offset += 8)
+    {
+        reverse_bytes(buffer + offset, 8);
+    }
+    hdr_reset(loaded);
+    mu_assert("Should load swapped", 0 == hdr_snapshot_load_into(loaded, buffer, size));
+    mu_assert("Swapped count", compare_int64(loaded->total_count, h->total_count));
+    mu_assert("Swapped p50", compare_int64(hdr_value_at_percentile(loaded, 50.0), hdr_value_at_percentile(h, 50.0)));
+
+    buffer[0] ^= 0xff;
+    mu_assert("Should reject bad cookie", EINVAL == hdr_snapshot_load_into(loaded, buffer, size));
+
+    free(buffer);
+    hdr_close(h);
+    hdr_close(loaded);
+    hdr_close(packed);
+
+    return 0;
+}
+
+static char* test_buffered_recorder()
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* expected;
+    struct hdr_histogram* sample;
+    struct hdr_buffered_recorder br;
+    struct hdr_interval_recorder r;
+    struct hdr_record_buffer* a = malloc(sizeof(struct hdr_record_buffer));
+    struct hdr_record_buffer* b = malloc(sizeof(struct hdr_record_buffer));
+    int64_t i;
+
+    hdr_init(1, INT64_C(3600000000), 3, &h);
+    hdr_init(1, INT64_C(3600000000), 3, &expected);
+
+    mu_assert("Should init", 0 == hdr_buffered_recorder_init(&br, h));
+    hdr_record_buffer_init(a, &br);
+    hdr_record_buffer_init(b, &br);
+
+    for (i = 0; i < 1000; i++)
+    {
+        hdr_record_buffer_record_value(a, (i % 10) * 1000);
+        hdr_record_value(expected, (i % 10) * 1000);
+    }
+    hdr_record_buffer_record_values(b, 123456, 3);
+    hdr_record_values(expected, 123456, 3);
+
+    mu_assert("Flushed when full", h->total_count > 0);
+    mu_assert("Still buffered", h->total_count < expected->total_count);
+
+    hdr_record_buffer_record_value(b, -1);
+    hdr_record_buffer_record_values(b, INT64_C(36000000000), 2);
+    hdr_buffered_recorder_flush(&br);
+
+    mu_assert("Total count", compare_int64(h->total_count, expected->total_count));
+    mu_assert("Min", compare_int64(hdr_min(h), hdr_min(expected)));
+    mu_assert("Max", compare_int64(hdr_max(h), hdr_max(expected)));
+    mu_assert("Count at value", compare_int64(hdr_count_at_value(h, 5000), 100));
+    mu_assert("Count at zero", compare_int64(hdr_count_at_value(h, 0), 100));
+    mu_assert("Dropped", compare_int64(hdr_buffered_recorder_dropped(&br), 3));
+    mu_assert("No interval to sample", NULL == hdr_buffered_recorder_sample_and_recycle(&br, NULL));
+
+    hdr_record_buffer_record_value(a, 7);
+    hdr_record_buffer_destroy(a);
+    mu_assert("Flushed on destroy", compare_int64(hdr_count_at_value(h, 7), 1));
+    hdr_record_buffer_destroy(b);
+    hdr_buffered_recorder_destroy(&br);
+
+    hdr_interval_recorder_init_all(&r, 1, INT64_C(3600000000), 3);
+    mu_assert("Should init interval", 0 == hdr_buffered_recorder_init_interval(&br, &r));
+    hdr_record_buffer_init(a, &br);
+
+    hdr_record_buffer_record_values(a, 1000, 5);
+    sample = hdr_buffered_recorder_sample_and_recycle(&br, NULL);
+    mu_assert("Sample includes buffered values", compare_int64(sample->total_count, 5));
+
+    hdr_record_buffer_record_value(a, 2000);
+    sample = hdr_buffered_recorder_sample_and_recycle(&br, sample);
+    mu_assert("Next interval", compare_int64(sample->total_count, 1));
+    mu_assert("Next interval value", hdr_values_are_equivalent(sample, hdr_max(sample), 2000));
+
+    hdr_reset(sample);
+    sample = hdr_buffered_recorder_sample_and_recycle(&br, sample);
+    hdr_record_buffer_record_values(a, 0, 4);
+    hdr_reset(sample);
+    sample = hdr_buffered_recorder_sample_and_recycle(&br, sample);
+    mu_assert("Zero interval", compare_int64(sample->total_count, 4));
+    mu_assert("Zero interval max", compare_int64(hdr_max(sample), 0));
+    mu_assert("Zero interval min", compare_int64(hdr_min(sample), 0));
+
+    hdr_record_buffer_destroy(a);
+    hdr_buffered_recorder_destroy(&br);
+    hdr_close(sample);
+    hdr_interval_recorder_destroy(&r);
+
+    free(a);
+    free(b);
+    hdr_close(h);
+    hdr_close(expected);
+
+    return 0;
+}
+
+static char* test_percpu_recorder()
+{
+    struct hdr_percpu_recorder pr;
+    struct hdr_histogram* sample;
+    struct hdr_histogram* expected;
+    int64_t i;
+
+    mu_assert("Should reject negative slot count", EINVAL == hdr_percpu_recorder_init(&pr, 1, 1000000, 3, -1));
+    mu_assert("Should init", 0 == hdr_percpu_recorder_init(&pr, 1, 1000000, 3, 0));
+    mu_assert("One slot per CPU", pr.slot_count >= 1);
+    hdr_percpu_recorder_destroy(&pr);
+
+    hdr_init(1, 1000000, 3, &expected);
+    mu_assert("Should init", 0 == hdr_percpu_recorder_init(&pr, 1, 1000000, 3, 4));
+
+    for (i = 1; i <= 1000; i++)
+    {
+        mu_assert("Should record", hdr_percpu_recorder_record_value(&pr, i));
+        hdr_record_value(expected, i);
+    }
+    mu_assert("Should record values", hdr_percpu_recorder_record_values(&pr, 5000, 10));
+    hdr_record_values(expected, 5000, 10);
+    mu_assert("Should record corrected", hdr_percpu_recorder_record_corrected_value(&pr, 10000, 1000));
+    hdr_record_corrected_value(expected, 10000, 1000);
+    mu_assert("Should reject out of range", !hdr_percpu_recorder_record_value(&pr, INT64_C(10000000)));
+
+    sample = hdr_percpu_recorder_sample(&pr);
+    mu_assert("Total count", compare_int64(sample->total_count, expected->total_count));
+    mu_assert("Max", compare_int64(hdr_max(sample), hdr_max(expected)));
+    mu_assert("p50", compare_int64(hdr_value_at_percentile(sample, 50.0), hdr_value_at_percentile(expected, 50.0)));
+
+    sample = hdr_percpu_recorder_sample(&pr);
+    mu_assert("Empty interval", compare_int64(sample->total_count, 0));
+
+    hdr_percpu_recorder_record_value(&pr, 42);
+    sample = hdr_percpu_recorder_sample(&pr);
+    mu_assert("Next interval", compare_int64(sample->total_count, 1));
+    mu_assert("Next interval value", compare_int64(hdr_count_at_value(sample, 42), 1));
+
+    hdr_percpu_recorder_record_value(&pr, 43);
+    sample = hdr_percpu_recorder_sample_and_recycle(&pr, expected);
+    mu_assert("Recycled histogram", sample == expected);
+    mu_assert("Recycled is reset", compare_int64(sample->total_count, 1));
+
+    hdr_percpu_recorder_destroy(&pr);
+    hdr_close(expected);
+
+    return 0;
+}
+
+static char* test_auto_resize()
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* packed;
+    struct hdr_histogram* large;
+    struct hdr_histogram* expected;
+    const int64_t batch[] = { 10, INT64_C(50000000000), 20 };
+    int32_t counts_len;
+    int64_t i;
+
+    hdr_init(1, 1000, 3, &h);
+    hdr_init_packed(1, 1000, 3, &packed);
+    hdr_init(1, INT64_C(3600000000), 3, &large);
+    hdr_init(1, INT64_C(3600000000), 3, &expected);
+
+    mu_assert("Should drop without auto resize", !hdr_record_value(h, 100000));
+
+    hdr_set_auto_resize(h, true);
+    hdr_set_auto_resize(packed, true);
+    counts_len = h->counts_len;
+
+    for (i = 1; i <= 1000; i++)
+    {
+        hdr_record_value(h, i);
+        hdr_record_value(packed, i);
+        hdr_record_value(expected, i);
+    }
+    mu_assert("Should not grow in range", compare_int64(h->counts_len, counts_len));
+
+    mu_assert("Should record beyond range", hdr_record_value(h, INT64_C(3000000000)));
+    mu_assert("Should record beyond range packed", hdr_record_value(packed, INT64_C(3000000000)));
+    hdr_record_value(expected, INT64_C(3000000000));
+
+    mu_assert("Should have grown", h->counts_len > counts_len);
+    mu_assert("Highest trackable", h->highest_trackable_value >= INT64_C(3000000000));
+    mu_assert("Max", compare_int64(hdr_max(h), hdr_max(expected)));
+    mu_assert("Max packed", compare_int64(hdr_max(packed), hdr_max(expected)));
+    mu_assert("Existing counts kept", compare_int64(hdr_count_at_value(h, 500), 1));
+    mu_assert("Existing counts kept packed", compare_int64(hdr_count_at_value(packed, 500), 1));
+    mu_assert("p50", compare_int64(hdr_value_at_percentile(h, 50.0), hdr_value_at_percentile(expected, 50.0)));
+    mu_assert("p100", compare_int64(hdr_value_at_percentile(h, 100.0), hdr_value_at_percentile(expected, 100.0)));
+
+    hdr_reset(h);
+    hdr_record_value(large, INT64_C(3600000000));
+    mu_assert("Add should resize", compare_int64(hdr_add(h, large), 0));
+    mu_assert("Add max", compare_int64(hdr_max(h), hdr_max(large)));
+
+    mu_assert("Batch should resize", compare_int64(hdr_record_values_batch(h, batch, 3), 0));
+    mu_assert("Batch max", hdr_values_are_equivalent(h, hdr_max(h), INT64_C(50000000000)));
+
+    /* Shifting leaves the counts normalised, with a negative offset when shifted right. */
+    hdr_close(h);
+    hdr_close(packed);
+    hdr_init(1, 1000000, 3, &h);
+    hdr_init_packed(1, 1000000, 3, &packed);
+    hdr_set_auto_resize(h, true);
+    hdr_set_auto_resize(packed, true);
+    for (i = 1; i <= 10; i++)
+    {
+        hdr_record_value(h, i * 10000);
+        hdr_record_value(packed, i * 10000);
+    }
+
+    mu_assert("Should shift right", 0 == hdr_shift_values_right(h, 3));
+    mu_assert("Should shift right packed", 0 == hdr_shift_values_right(packed, 3));
+    mu_assert("Shifted record beyond range", hdr_record_value(h, INT64_C(3000000000)));
+    mu_assert("Shifted record beyond range packed", hdr_record_value(packed, INT64_C(3000000000)));
+    for (i = 1; i <= 10; i++)
+    {
+        mu_assert("Shifted counts kept", compare_int64(hdr_count_at_value(h, (i * 10000) >> 3), 1));
+        mu_assert("Shifted counts kept packed", compare_int64(hdr_count_at_value(packed, (i * 10000) >> 3), 1));
+    }
+    mu_assert("Shifted total", compare_int64(h->total_count, 11));
+    mu_assert("Shifted max", hdr_values_are_equivalent(h, hdr_max(h), INT64_C(3000000000)));
+    mu_assert("Shifted count at max", compare_int64(hdr_count_at_value(h, INT64_C(3000000000)), 1));
+    mu_assert("Shifted count at max packed", compare_int64(hdr_count_at_value(packed, INT64_C(3000000000)), 1));
+
+    hdr_reset(h);
+    hdr_record_value(h, 10000);
+    mu_assert("Should shift left", 0 == hdr_shift_values_left(h, 1));
+    mu_assert("Shifted left record beyond range", hdr_record_value(h, INT64_C(500000000000)));
+    mu_assert("Shifted left counts kept", compare_int64(hdr_count_at_value(h, 20000), 1));
+    mu_assert("Shifted left count at max", compare_int64(hdr_count_at_value(h, INT64_C(500000000000)), 1));
+
+    hdr_close(h);
+    hdr_close(packed);
+    hdr_close(large);
+    hdr_close(expected);
+
+    return 0;
+}
+
+static char* test_shift_values()
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* expected;
+    struct hdr_histogram* merged;
+    struct hdr_iter iter;
+    int64_t i;
+
+    hdr_init(1, INT64_C(3600000000), 3, &h);
+    hdr_init(1, INT64_C(3600000000), 3, &expected);
+    hdr_init(1, INT64_C(3600000000), 3, &merged);
+
+    for (i = 0; i < 5000; i++)
+    {
+        hdr_record_value(h, i * 7);
+        hdr_record_value(expected, (i * 7) << 4);
+    }
+
+    mu_assert("Should reject negative shift", EINVAL == hdr_shift_values_left(h, -1));
+    mu_assert("Should reject overflow", ERANGE == hdr_shift_values_left(h, 40));
+    mu_assert("Should shift left", 0 == hdr_shift_values_left(h, 4));
+
+    mu_assert("Total count", compare_int64(h->total_count, expected->total_count));
+    mu_assert("Zero count", compare_int64(hdr_count_at_value(h, 0), 1));
+    mu_assert("Min", compare_int64(hdr_min(h), hdr_min(expected)));
+    mu_assert("Max", compare_int64(hdr_max(h), hdr_max(expected)));
+    mu_assert("p50", compare_int64(hdr_value_at_percentile(h, 50.0), hdr_value_at_percentile(expected, 50.0)));
+    mu_assert("p99", compare_int64(hdr_value_at_percentile(h, 99.0), hdr_value_at_percentile(expected, 99.0)));
+
+    hdr_iter_recorded_init(&iter, h);
+    while (hdr_iter_next(&iter))
+    {
+        mu_assert("Recorded count", compare_int64(iter.count, hdr_count_at_value(expected, iter.value)));
+    }
+
+    mu_assert("Should not shift lowest values away", ERANGE == hdr_shift_values_right(h, 4));
+
+    hdr_reset(h);
+    hdr_reset(expected);
+    for (i = 1; i <= 5000; i++)
+    {
+        hdr_record_value(h, i * 100000);
+        hdr_record_value(expected, (i * 100000) >> 3);
+    }
+
+    mu_assert("Should shift right", 0 == hdr_shift_values_right(h, 3));
+    mu_assert("Right min", compare_int64(hdr_min(h), hdr_min(expected)));
+    mu_assert("Right max", compare_int64(hdr_max(h), hdr_max(expected)));
+    mu_assert("Right p90", compare_int64(hdr_value_at_percentile(h, 90.0), hdr_value_at_percentile(expected, 90.0)));
+
+    hdr_record_value(h, 12345);
+    hdr_record_value(expected, 12345);
+    mu_assert("Record after shift", compare_int64(hdr_count_at_value(h, 12345), 1));
+
+    mu_assert("Add from shifted", compare_int64(hdr_add(merged, h), 0));
+    mu_assert("Add from shifted p50",
+              compare_int64(hdr_value_at_percentile(merged, 50.0), hdr_value_at_percentile(expected, 50.0)));
+
+    hdr_reset_internal_counters(h);
+    mu_assert("Internal counters total", compare_int64(h->total_count, expected->total_count));
+    mu_assert("Internal counters min", compare_int64(hdr_min(h), hdr_min(expected)));
+    mu_assert("Internal counters max", compare_int64(hdr_max(h), hdr_max(expected)));
+
+    hdr_close(h);
+    hdr_close(expected);
+    hdr_close(merged);
+
+    return 0;
+}
+
+static char* test_init_aligned()
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* large;
+    struct hdr_histogram* expected;
+    int64_t i;
+
+    mu_assert("Hot fields in first cache line", offsetof(struct hdr_histogram, auto_resize) < 64);
+
+    mu_assert("Failed to init", 0 == hdr_init_aligned(1, INT64_C(3600000000), 3, false, &h));
+    mu_assert("Failed to init large", 0 == hdr_init_aligned(1, INT64_C(3600000000), 5, true, &large));
+    hdr_init(1, INT64_C(3600000000), 3, &expected);
+
+    mu_assert("Header should be aligned", 0 == ((uintptr_t) h % 64));
+    mu_assert("Counts should be aligned", 0 == ((uintptr_t) h->counts % 64));
+    mu_assert("Counts should follow header", (uint8_t*) h->counts - (uint8_t*) h < 2 * 64 + (ptrdiff_t) sizeof(struct hdr_histogram));
+
+    for (i = 1; i < 100000; i += 7)
+    {
+        hdr_record_value(h, i);
+        hdr_record_value(large, i);
+        hdr_record_value(expected, i);
+    }
+
+    mu_assert("Total count", compare_int64(h->total_count, expected->total_count));
+    mu_assert("p99", compare_int64(hdr_value_at_percentile(h, 99.0), hdr_value_at_percentile(expected, 99.0)));
+    mu_assert("Large total count", compare_int64(large->total_count, expected->total_count));
+    mu_assert("Large p50", compare_values((double) hdr_value_at_percentile(large, 50.0), 50000.0, 0.001));
+
+    hdr_reset(h);
+    hdr_set_auto_resize(h, true);
+    hdr_record_value(h, 1000);
+    mu_assert("Should resize", hdr_record_value(h, INT64_C(1) << 40));
+    mu_assert("Resized count", compare_int64(hdr_count_at_value(h, 1000), 1));
+    mu_assert("Resized max", hdr_values_are_equivalent(h, hdr_max(h), INT64_C(1) << 40));
+
+    hdr_close(h);
+    hdr_close(large);
+    hdr_close(expected);
+
+    return 0;
+}
+
+struct counting_allocator
+{
+    int64_t allocations;
+    int64_t frees;
+};
+
+static void* counting_malloc(void* context, size_t size)
+{
+    ((struct counting_allocator*) context)->allocations++;
+    return malloc(size);
+}
+
+static void* counting_calloc(void* context, size_t count, size_t size)
+{
+    ((struct counting_allocator*) context)->allocations++;
+    return calloc(count, size);
+}
+
+static void counting_free(void* context, void* ptr)
+{
+    ((struct counting_allocator*) context)->frees++;
+    free(ptr);
+}
+
+static char* test_allocator()
+{
+    struct counting_allocator counter = { 0, 0 };
+    struct hdr_allocator allocator;
+    struct hdr_histogram* h;
+    struct hdr_cumulative_index index;
+    int64_t allocations;
+
+    allocator.malloc_fn = counting_malloc;
+    allocator.calloc_fn = counting_calloc;
+    allocator.free_fn = counting_free;
+    allocator.context = &counter;
+
+    mu_assert("Failed to init", 0 == hdr_init_with_allocator(1, 1000, 3, &allocator, &h));
+    mu_assert("Should allocate through the allocator", counter.allocations > 0);
+
+    hdr_set_auto_resize(h, true);
+    hdr_record_value(h, 500);
+    mu_assert("Should resize", hdr_record_value(h, INT64_C(1) << 30));
+    mu_assert("Resized count", compare_int64(hdr_count_at_value(h, 500), 1));
+
+    allocations = counter.allocations;
+    mu_assert("Should init index", 0 == hdr_cumulative_index_init(&index, h));
+    mu_assert("Index should use the allocator", counter.allocations > allocations);
+    mu_assert("Index p50",
+              compare_int64(hdr_cumulative_index_value_at_percentile(&index, 50.0), hdr_value_at_percentile(h, 50.0)));
+    hdr_cumulative_index_destroy(&index);
+
+    hdr_close(h);
+    mu_assert("Should free everything allocated", compare_int64(counter.frees, counter.allocations));
+
+    return 0;
+}
+
+static char* test_init_in_buffer()
+{
+    struct counting_allocator counter = { 0, 0 };
+    struct hdr_allocator allocator;
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_histogram* h;
+    int64_t* buffer;
+    size_t size;
+
+    allocator.malloc_fn = counting_malloc;
+    allocator.calloc_fn = counting_calloc;
+    allocator.free_fn = counting_free;
+    allocator.context = &counter;
+
+    mu_assert("Should calculate config", 0 == hdr_calculate_bucket_config(1, 100000, 3, &cfg));
+    size = hdr_buffer_size(&cfg);
+    buffer = malloc(size);
+
+    mu_assert("Should reject small buffer", EINVAL == hdr_init_in_buffer(buffer, size - 1, &cfg, &allocator, &h));
+    mu_assert("Should reject unaligned buffer",
+              EINVAL == hdr_init_in_buffer((uint8_t*) buffer + 1, size, &cfg, &allocator, &h));
+    mu_assert("Should init", 0 == hdr_init_in_buffer(buffer, size, &cfg, &allocator, &h));
+    mu_assert("Histogram should be the buffer", (void*) h == (void*) buffer);
+
+    hdr_record_value(h, 1234);
+    mu_assert("Count", compare_int64(hdr_count_at_value(h, 1234), 1));
+    mu_assert("Should not allocate", compare_int64(counter.allocations, 0));
+
+    hdr_set_auto_resize(h, true);
+    mu_assert("Should resize", hdr_record_value(h, INT64_C(1) << 30));
+    mu_assert("Resized count", compare_int64(hdr_count_at_value(h, 1234), 1));
+    mu_assert("Counts should move out", compare_int64(counter.allocations, 1));
+
+    hdr_close(h);
+    mu_assert("Should free the moved counts", compare_int64(counter.frees, 1));
+
+    free(buffer);
+
+    return 0;
+}
+
 static struct mu_result all_tests()
 {
     mu_run_test(test_create);
@@ -492,6 +1983,31 @@ static struct mu_result all_tests()
     mu_run_test(test_scaling_equivalence);
     mu_run_test(test_out_of_range_values);
     mu_run_test(test_linear_iter_buckets_correctly);
+    mu_run_test(test_record_value_atomic);
+    mu_run_test(test_striped_histogram);
+    mu_run_test(test_record_values_batch);
+    mu_run_test(test_record_corrected_values_by_bucket);
+    mu_run_test(test_add);
+    mu_run_test(test_cumulative_index);
+    mu_run_test(test_value_at_percentiles);
+    mu_run_test(test_running_moments);
+    mu_run_test(test_packed_histogram);
+    mu_run_test(test_paged_histogram);
+    mu_run_test(test_reset_touched_range);
+    mu_run_test(test_occupancy_iteration);
+    mu_run_test(test_subtract);
+    mu_run_test(test_windowed_histogram);
+    mu_run_test(test_decaying_histogram);
+    mu_run_test(test_shared_histogram);
+    mu_run_test(test_persistent_histogram);
+    mu_run_test(test_snapshot);
+    mu_run_test(test_buffered_recorder);
+    mu_run_test(test_percpu_recorder);
+    mu_run_test(test_auto_resize);
+    mu_run_test(test_shift_values);
+    mu_run_test(test_init_aligned);
+    mu_run_test(test_allocator);
+    mu_run_test(test_init_in_buffer);
 
     mu_ok;
 }
@@ -0,0 +1,186 @@
+/**
+ * hdr_interval_recorder_perf.c
+ * Written by Michael Barker and released to the public domain,
+ * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * Measures how recording throughput through a single hdr_interval_recorder
+ * scales as the number of writer threads increases.
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <hdr_histogram.h>
+#include <hdr_interval_recorder.h>
+
+#include "hdr_time.h"
+
+struct writer_context
+{
+    struct hdr_interval_recorder* recorder;
+    int64_t iterations;
+    bool atomic;
+};
+
+static hdr_timespec_t diff(hdr_timespec_t* start, hdr_timespec_t* end)
+{
+    hdr_timespec_t temp;
+    if ((end->tv_nsec-start->tv_nsec) < 0)
+    {
+        temp.tv_sec = end->tv_sec - start->tv_sec - 1;
+        temp.tv_nsec = 1000000000 + end->tv_nsec-start->tv_nsec;
+    }
+    else
+    {
+        temp.tv_sec = end->tv_sec - start->tv_sec;
+        temp.tv_nsec = end->tv_nsec - start->tv_nsec;
+    }
+    return temp;
+}
+
+/* Formats the given double with 2 dps, and , thousand separators */
+static char *format_double(double d)
+{
+    int p;
+    static char buffer[30];
+
+    snprintf(buffer, sizeof(buffer), "%0.2f", d);
+
+    p = (int) strlen(buffer) - 6;
+
+    while (p > 0)
+    {
+        memmove(&buffer[p + 1], &buffer[p], strlen(buffer) - p + 1);
+        buffer[p] = ',';
+
+        p = p - 3;
+    }
+
+    return buffer;
+}
+
+static void* record_values(void* arg)
+{
+    struct writer_context* context = arg;
+    int64_t i;
+
+    for (i = 1; i <= context->iterations; i++)
+    {
+        if (context->atomic)
+        {
+            hdr_interval_recorder_record_value_atomic(context->recorder, i & 0xFFFFF);
+        }
+        else
+        {
+            hdr_interval_recorder_record_value(context->recorder, i & 0xFFFFF);
+        }
+    }
+
+    return NULL;
+}
+
+static int run(int thread_count, int64_t iterations, bool atomic)
+{
+    struct hdr_interval_recorder recorder;
+    struct writer_context context;
+    struct hdr_histogram* sample;
+    pthread_t* threads;
+    hdr_timespec_t t0, t1, taken;
+    double time_taken, ops_sec;
+    int64_t recorded;
+    int i, rc;
+
+    rc = hdr_interval_recorder_init_all(&recorder, 1, INT64_C(24) * 60 * 60 * 1000000, 3);
+    if (rc != 0)
+    {
+        fprintf(stderr, "Failed to initialise recorder: %d\n", rc);
+        return rc;
+    }
+
+    threads = calloc((size_t) thread_count, sizeof(pthread_t));
+    if (!threads)
+    {
+        hdr_interval_recorder_destroy(&recorder);
+        return -1;
+    }
+
+    context.recorder = &recorder;
+    context.iterations = iterations;
+    context.atomic = atomic;
+
+    recorded = 0;
+
+    hdr_gettime(&t0);
+    for (i = 0; i < thread_count; i++)
+    {
+        pthread_create(&threads[i], NULL, record_values, &context);
+    }
+
+    /* Sample concurrently to keep the phaser honest. */
+    for (i = 0; i < 10; i++)
+    {
+        usleep(1000);
+        sample = hdr_interval_recorder_sample(&recorder);
+        recorded += sample->total_count;
+        hdr_reset(sample);
+    }
+
+    for (i = 0; i < thread_count; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    hdr_gettime(&t1);
+
+    sample = hdr_interval_recorder_sample(&recorder);
+    recorded += sample->total_count;
+
+    taken = diff(&t0, &t1);
+    time_taken = taken.tv_sec + taken.tv_nsec / 1000000000.0;
+    ops_sec = (thread_count * iterations) / time_taken;
+
+    printf(
+        "%-10s threads: %3d, ops/sec: %20s, lost: %" PRId64 "\n",
+        atomic ? "atomic" : "non-atomic", thread_count, format_double(ops_sec),
+        (thread_count * iterations) - recorded);
+
+    free(threads);
+    hdr_interval_recorder_destroy(&recorder);
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int64_t iterations = 10000000;
+    int max_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_count;
+
+    if (argc > 1)
+    {
+        max_threads = atoi(argv[1]);
+    }
+    if (argc > 2)
+    {
+        iterations = atoll(argv[2]);
+    }
+    if (max_threads < 1)
+    {
+        max_threads = 1;
+    }
+
+    for (thread_count = 1; thread_count <= max_threads; thread_count *= 2)
+    {
+        if (run(thread_count, iterations, false) != 0 || run(thread_count, iterations, true) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}